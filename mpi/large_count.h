@@ -0,0 +1,105 @@
+#ifndef LARGE_COUNT_H
+#define LARGE_COUNT_H
+
+#include <limits.h>
+#include <stdlib.h>
+#include <mpi.h>
+
+// Large-count transfers. MPI counts and displacements are int, and OpenMPI 4
+// has no MPI-4 _c calls, so payloads of 2^31 bytes or elements and more are
+// either sent as messages of at most MPI_CHUNK_BYTES bytes or described with
+// derived datatypes that keep the count small. Build with a small
+// -DMPI_CHUNK_BYTES to exercise the chunked paths on small inputs.
+#ifndef MPI_CHUNK_BYTES
+#define MPI_CHUNK_BYTES (1LL << 30)
+#endif
+
+// Tag of the chunks of alltoallv_bytes
+#define CHUNK_TAG 4
+
+static inline long long chunk_len(long long len, long long off) {
+    return len - off < MPI_CHUNK_BYTES ? len - off : MPI_CHUNK_BYTES;
+}
+
+// MPI_Send / MPI_Recv of len bytes, as ceil(len / MPI_CHUNK_BYTES) messages.
+// Both sides must already agree on len.
+static inline void send_bytes(const char *buf, long long len, int dest, int tag, MPI_Comm comm) {
+    for (long long off = 0; off < len; off += MPI_CHUNK_BYTES) {
+        MPI_Send(buf + off, (int)chunk_len(len, off), MPI_CHAR, dest, tag, comm);
+    }
+}
+
+static inline void recv_bytes(char *buf, long long len, int source, int tag, MPI_Comm comm) {
+    for (long long off = 0; off < len; off += MPI_CHUNK_BYTES) {
+        MPI_Recv(buf + off, (int)chunk_len(len, off), MPI_CHAR, source, tag, comm, MPI_STATUS_IGNORE);
+    }
+}
+
+// MPI_Alltoallv of bytes with 64-bit counts and displacements. When every
+// count and displacement of every rank fits in one chunk this is a single
+// MPI_Alltoallv; otherwise each pair of ranks exchanges its bytes as chunked
+// nonblocking messages, which arrive in order since they share source and tag.
+static inline void alltoallv_bytes(const char *sendbuf, const long long *sendcounts, const long long *sdispls,
+                                   char *recvbuf, const long long *recvcounts, const long long *rdispls,
+                                   MPI_Comm comm) {
+    int size;
+    MPI_Comm_size(comm, &size);
+
+    int small = 1;
+    for (int r = 0; r < size; r++) {
+        if (sendcounts[r] + sdispls[r] > MPI_CHUNK_BYTES || recvcounts[r] + rdispls[r] > MPI_CHUNK_BYTES) {
+            small = 0;
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &small, 1, MPI_INT, MPI_LAND, comm);
+
+    if (small) {
+        int *counts = (int *)malloc(4 * size * sizeof(int));
+        for (int r = 0; r < size; r++) {
+            counts[r] = (int)sendcounts[r];
+            counts[size + r] = (int)sdispls[r];
+            counts[2 * size + r] = (int)recvcounts[r];
+            counts[3 * size + r] = (int)rdispls[r];
+        }
+        MPI_Alltoallv(sendbuf, counts, counts + size, MPI_CHAR, recvbuf, counts + 2 * size, counts + 3 * size,
+                      MPI_CHAR, comm);
+        free(counts);
+        return;
+    }
+
+    long long messages = 0;
+    for (int r = 0; r < size; r++) {
+        messages += (sendcounts[r] + MPI_CHUNK_BYTES - 1) / MPI_CHUNK_BYTES;
+        messages += (recvcounts[r] + MPI_CHUNK_BYTES - 1) / MPI_CHUNK_BYTES;
+    }
+    MPI_Request *requests = (MPI_Request *)malloc(messages * sizeof(MPI_Request));
+    int n = 0;
+    for (int r = 0; r < size; r++) {
+        for (long long off = 0; off < recvcounts[r]; off += MPI_CHUNK_BYTES) {
+            MPI_Irecv(recvbuf + rdispls[r] + off, (int)chunk_len(recvcounts[r], off), MPI_CHAR, r, CHUNK_TAG,
+                      comm, &requests[n++]);
+        }
+    }
+    for (int r = 0; r < size; r++) {
+        for (long long off = 0; off < sendcounts[r]; off += MPI_CHUNK_BYTES) {
+            MPI_Isend(sendbuf + sdispls[r] + off, (int)chunk_len(sendcounts[r], off), MPI_CHAR, r, CHUNK_TAG,
+                      comm, &requests[n++]);
+        }
+    }
+    MPI_Waitall(n, requests, MPI_STATUSES_IGNORE);
+    free(requests);
+}
+
+// A committed datatype for one rows x cols matrix of elem, so that counts
+// and displacements can be given in whole matrices: K * rows * cols may pass
+// INT_MAX while K stays small. Free with MPI_Type_free.
+static inline MPI_Datatype matrix_type(int rows, int cols, MPI_Datatype elem) {
+    MPI_Datatype row, matrix;
+    MPI_Type_contiguous(cols, elem, &row);
+    MPI_Type_contiguous(rows, row, &matrix);
+    MPI_Type_commit(&matrix);
+    MPI_Type_free(&row);
+    return matrix;
+}
+
+#endif
@@ -0,0 +1,117 @@
+#!/bin/sh
+# Checks the large-count paths (large_count.h) without needing that much data:
+#
+# 1. The phonebook programs built with a tiny MPI_CHUNK_BYTES, so that every
+#    send_string, shard, bucket exchange and MPI-IO write is split into many
+#    chunks, must give the same output.txt and summary as the default build
+#    in every mode.
+# 2. mat_m --input reads a sparse batch file whose A block passes 2^31 bytes
+#    (and K * M * N passes INT_MAX elements), so the B block and the last A
+#    matrices sit at 64-bit file offsets. Only a few rows hold data; the
+#    result file must contain exactly their products.
+#
+# ./large_count_test.sh [rank counts]        (default: 1 3 4)
+# MPIRUN="mpirun --oversubscribe" ./large_count_test.sh
+# Part 2 needs about 2.3 GB of memory across the ranks.
+
+set -e
+cd "$(dirname "$0")"
+
+MPIRUN=${MPIRUN:-mpirun}
+RANKS=${*:-1 3 4}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+failed=0
+
+# --- 1. Tiny chunks against the default build ---
+for prog in phone_book phone_book_sort_line phone_book_case_insensitive sub_str; do
+    mpic++ -O2 $prog.cpp -o "$WORK/$prog"
+    mpic++ -O2 -DMPI_CHUNK_BYTES=64 $prog.cpp -o "$WORK/${prog}_chunked"
+done
+
+# A few hundred KB of phonebook, so every message spans many chunks
+: > "$WORK/book.txt"
+for i in $(seq 100); do cat input.txt >> "$WORK/book.txt"; done
+
+# Runs one case in $WORK/$1 and keeps its output.txt and its stdout without
+# the timing lines (totals and per-rank "... seconds")
+run_case() {
+    dir=$WORK/$1 && shift
+    mkdir -p "$dir" && rm -f "$dir/output.txt"
+    # stdin from /dev/null, as mpirun would otherwise eat the case list
+    (cd "$dir" && $MPIRUN -np $np "$@" < /dev/null | grep -v -i -e 'time' -e 'seconds' | sort > stdout.txt)
+    touch "$dir/output.txt"  # --count, --exists and --top print instead
+}
+
+for np in $RANKS; do
+    while IFS='|' read -r prog args term; do
+        run_case default "$WORK/$prog" $args "$WORK/book.txt" "$term"
+        run_case chunked "$WORK/${prog}_chunked" $args "$WORK/book.txt" "$term"
+        if cmp -s "$WORK/default/output.txt" "$WORK/chunked/output.txt" &&
+           cmp -s "$WORK/default/stdout.txt" "$WORK/chunked/stdout.txt"; then
+            echo "ok    np=$np $prog $args '$term'"
+        else
+            echo "FAIL  np=$np $prog $args '$term'"
+            failed=1
+        fi
+    done <<EOF
+phone_book||TUMPA
+phone_book|--count|01
+phone_book|--top 50|MD
+phone_book|--sample-sort|01
+phone_book|--mpi-io|01
+phone_book|--shm|A
+phone_book|--max-errors 1|HASEN
+phone_book|--exists|RAHMAN
+phone_book|--regex|MD.*HASAN
+phone_book|--phone|017
+phone_book_sort_line|--sample-sort|01
+phone_book_sort_line|--shm --mpi-io|A
+phone_book_case_insensitive|--top 20|md
+phone_book_case_insensitive|--mpi-io|rahman
+sub_str||ul mah
+sub_str|--shm --mpi-io|hasan
+EOF
+done
+
+# --- 2. A sparse batch past 2^31 bytes ---
+# uint8, K = 2100 matrices of 1024 x 1024 (2.2 GB of A) times one shared
+# 1024 x 1 B of ones, so R[k][i] is the row sum of A[k][i] % 100
+K=2100 M=1024 N=1024 P=1
+mpicc -O3 mat_m.c -o "$WORK/mat_m"
+
+# Little-endian int32, as the header is in host order on x86 and ARM
+le32() {
+    printf "$(printf '\\%03o\\%03o\\%03o\\%03o' $(($1 & 255)) $(($1 >> 8 & 255)) $(($1 >> 16 & 255)) $(($1 >> 24 & 255)))"
+}
+# Writes $2 copies of byte value $3 at offset $1 of the batch
+poke() {
+    head -c $2 /dev/zero | tr '\0' "\\$(printf '%03o' $3)" |
+        dd of="$WORK/batch.bin" bs=1 seek=$1 conv=notrunc status=none
+}
+
+BATCH=$WORK/batch.bin
+{ printf MATB; le32 1; le32 $K; le32 $M; le32 $N; le32 $P; le32 2; le32 1; } > "$BATCH"
+a_disp=32
+b_disp=$((a_disp + K * M * N))
+truncate -s $((b_disp + N * P)) "$BATCH"
+poke $b_disp $N 1                                     # B: all ones
+poke $a_disp 5 9                                      # A[0][0]: 5 x 9 -> 45
+poke $((a_disp + (K - 1) * M * N + 7 * N)) 3 7        # A[K-1][7]: 3 x 7 -> 21
+echo "sparse batch: $(ls -l "$BATCH" | awk '{print $5}') bytes, B at offset $b_disp"
+
+for np in $RANKS; do
+    [ $((K % np)) -eq 0 ] || continue
+    (cd "$WORK" && $MPIRUN -np $np ./mat_m --input batch.bin --output result.bin --bench | grep '^{')
+    r_first=$(od -An -tu1 -j 32 -N 1 "$WORK/result.bin" | tr -d ' ')
+    r_last=$(od -An -tu1 -j $((32 + (K - 1) * M * P + 7)) -N 1 "$WORK/result.bin" | tr -d ' ')
+    r_sum=$(od -An -tu1 -v -j 32 "$WORK/result.bin" | tr -s ' ' '\n' | awk '{s += $1} END {print s}')
+    if [ "$r_first" = 45 ] && [ "$r_last" = 21 ] && [ "$r_sum" = 66 ]; then
+        echo "ok    np=$np mat_m --input past 2^31 bytes"
+    else
+        echo "FAIL  np=$np mat_m --input: R[0][0]=$r_first R[K-1][7]=$r_last sum=$r_sum (want 45 21 66)"
+        failed=1
+    fi
+done
+
+exit $failed
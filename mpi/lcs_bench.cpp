@@ -0,0 +1,110 @@
+#include <bits/stdc++.h>
+#include "suffix_automaton.h"
+
+using namespace std;
+
+// Benchmarks the suffix automaton kernel of sub_str.cpp against the DP
+// kernel it replaced, for growing search term lengths, and checks that both
+// return the same lower-cased substring for every line.
+
+string to_lower(const string &s) {
+    string res = s;
+    transform(res.begin(), res.end(), res.begin(), ::tolower);
+    return res;
+}
+
+// The previous sub_str.cpp kernel: full DP table per line
+string longest_common_substring(const string &a, const string &b) {
+    string sa = to_lower(a);
+    string sb = to_lower(b);
+    int n = sa.size(), m = sb.size();
+    vector<vector<int>> dp(n+1, vector<int>(m+1, 0));
+    int best = 0;
+    int end_pos = -1;
+    for (int i = 1; i <= n; i++) {
+        for (int j = 1; j <= m; j++) {
+            if (sa[i-1] == sb[j-1]) {
+                dp[i][j] = dp[i-1][j-1] + 1;
+                if (dp[i][j] > best) {
+                    best = dp[i][j];
+                    end_pos = i-1;
+                }
+            }
+        }
+    }
+    if (best > 0) {
+        return sa.substr(end_pos - best + 1, best);
+    }
+    return "";
+}
+
+double seconds_since(chrono::steady_clock::time_point t) {
+    return chrono::duration<double>(chrono::steady_clock::now() - t).count();
+}
+
+int main(int argc, char **argv) {
+    const char *file = argc > 1 ? argv[1] : "input.txt";
+    int repeat = argc > 2 ? atoi(argv[2]) : 100;
+
+    vector<string> lines;
+    ifstream f(file);
+    string line;
+    while (getline(f, line)) {
+        if (!line.empty()) lines.push_back(line);
+    }
+    if (lines.empty()) {
+        cerr << "Could not read lines from " << file << endl;
+        return 1;
+    }
+
+    // Terms are cut from the text itself, with a typo so the match is partial
+    string pool;
+    for (const string &l : lines) pool += l;
+    mt19937 rng(7);
+
+    for (int m : {4, 8, 16, 32, 64, 128, 256}) {
+        string term = pool.substr(rng() % (pool.size() - m), m);
+        term[m / 2] = '#';
+
+        string dp_best, sam_best;
+        auto t = chrono::steady_clock::now();
+        for (int r = 0; r < repeat; r++) {
+            for (const string &l : lines) {
+                string sub = longest_common_substring(l, term);
+                if (sub.size() > dp_best.size()) dp_best = sub;
+            }
+        }
+        double dp_time = seconds_since(t);
+
+        t = chrono::steady_clock::now();
+        bool same = true;
+        for (int r = 0; r < repeat; r++) {
+            SuffixAutomaton sam = build_suffix_automaton(to_lower(term));
+            for (const string &l : lines) {
+                int end;
+                int len = longest_common_substring(sam, l, end);
+                if (len > (int)sam_best.size()) sam_best = to_lower(l.substr(end - len + 1, len));
+            }
+        }
+        double sam_time = seconds_since(t);
+
+        for (const string &l : lines) {
+            SuffixAutomaton sam = build_suffix_automaton(to_lower(term));
+            int end;
+            int len = longest_common_substring(sam, l, end);
+            string sub = len > 0 ? to_lower(l.substr(end - len + 1, len)) : "";
+            same = same && sub == longest_common_substring(l, term);
+        }
+
+        printf("term %3d bytes  DP %.3f s  automaton %.3f s  speedup %6.1fx  %s\n",
+               m, dp_time, sam_time, dp_time / sam_time,
+               same && dp_best == sam_best ? "same results" : "RESULT MISMATCH");
+    }
+    return 0;
+}
+
+
+/*
+g++ -O2 lcs_bench.cpp -o lcs_bench
+./lcs_bench input.txt 100
+*/
@@ -0,0 +1,83 @@
+#ifndef MAT_BENCH_H
+#define MAT_BENCH_H
+
+#include <stdio.h>
+#include <mpi.h>
+#include "mat_kernels.h"
+
+// --bench support for the batched matrix programs: phase timings, a sampled
+// check of R against a serial reference, and one JSON line per run on the
+// root (collected by mat_bench.sh).
+
+// Phase times of one run in seconds, each the slowest rank's
+typedef struct {
+    double scatter, compute, gather;
+} MatTimes;
+
+// Number of R entries checked by --bench
+#define BENCH_SAMPLES 1000
+
+// Checks samples entries R[k][i][j], picked with a fixed LCG, against
+// sum_l A[k][i][l] * B[k][l][j] % 100 computed exactly in 64 bits.
+// shared_b: B holds one N x P matrix for every k. Returns the number of
+// mismatches.
+static inline long verify_sample(ElemType t, int K, int M, int N, int P, const void *A, const void *B,
+                                 int shared_b, const void *R, int samples) {
+    unsigned long long state = 12345;
+    long errors = 0;
+    for (int s = 0; s < samples; s++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        unsigned long long x = state >> 16;
+        int k = x % K, i = (x / K) % M, j = (x / K / M) % P;
+
+        size_t a_row = ((size_t)k * M + i) * N;
+        size_t b_base = shared_b ? 0 : (size_t)k * N * P;
+        long long sum = 0;
+        for (int l = 0; l < N; l++) {
+            sum += (long long)elem_get(t, A, a_row + l) * elem_get(t, B, b_base + (size_t)l * P + j);
+        }
+        if (elem_get(t, R, ((size_t)k * M + i) * P + j) != sum % 100) errors++;
+    }
+    return errors;
+}
+
+// Bytes (or operations) per phase time in billions, 0 for a phase that did
+// not run
+static inline double per_ns(double amount, double seconds) {
+    return seconds > 0 ? amount / seconds / 1e9 : 0;
+}
+
+// Reduces the per-rank times to the slowest rank's and prints the run as one
+// JSON line on the root. GOPS counts a multiply-add as two operations;
+// scatter/gather bandwidth is the matrix volume over the phase time, and
+// compute bandwidth the compulsory A, B and R traffic over the compute time.
+static inline void report_bench(const char *program, ElemType t, int shm, int shared_b, int K, int M, int N,
+                                int P, MatTimes local, long errors, int samples) {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    MatTimes worst;
+    MPI_Reduce(&local, &worst, 3, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    if (rank != 0) return;
+
+    double esize = elem_size(t);
+    double bytes_a = (double)K * M * N * esize;
+    double bytes_b = (shared_b ? 1.0 : K) * N * P * esize;
+    double bytes_r = (double)K * M * P * esize;
+    double ops = 2.0 * K * M * N * P;
+
+    printf("{\"program\": \"%s\", \"type\": \"%s\", \"ranks\": %d, \"shm\": %d, \"shared_b\": %d, "
+           "\"K\": %d, \"M\": %d, \"N\": %d, \"P\": %d, "
+           "\"scatter_s\": %.6f, \"compute_s\": %.6f, \"gather_s\": %.6f, "
+           "\"gops\": %.3f, \"scatter_gbs\": %.3f, \"gather_gbs\": %.3f, \"compute_gbs\": %.3f, "
+           "\"samples\": %d, \"errors\": %ld}\n",
+           program, elem_name(t), size, shm, shared_b, K, M, N, P,
+           worst.scatter, worst.compute, worst.gather,
+           per_ns(ops, worst.compute), per_ns(bytes_a + bytes_b, worst.scatter),
+           per_ns(bytes_r, worst.gather), per_ns(bytes_a + bytes_b + bytes_r, worst.compute),
+           samples, errors);
+    fflush(stdout);
+}
+
+#endif
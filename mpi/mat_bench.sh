@@ -0,0 +1,37 @@
+#!/bin/sh
+# Sweeps mat_m and mat_variable over matrix sizes, element types and rank
+# counts with --bench, and collects one JSON line per run in mat_bench.jsonl.
+# Fails if any run's sampled results disagree with the serial reference.
+#
+# ./mat_bench.sh [rank counts]        (default: 1 2 4)
+# MPIRUN="mpirun --oversubscribe" ./mat_bench.sh 1 2 4 8
+
+set -e
+cd "$(dirname "$0")"
+
+MPIRUN=${MPIRUN:-mpirun}
+RANKS=${*:-1 2 4}
+OUT=mat_bench.jsonl
+
+mpicc -O3 mat_m.c -o mat_m
+mpicc -O3 mat_variable.c -o mat_var
+
+: > $OUT
+for np in $RANKS; do
+    # K is a multiple of every rank count up to 8, as mat_m needs
+    for dims in "120 100 100 100" "240 64 64 64" "24 256 256 256"; do
+        for type in int int16 uint8; do
+            for mode in "" --shared-b; do
+                $MPIRUN -np $np ./mat_m $dims --type $type $mode --bench | grep '^{' >> $OUT
+                $MPIRUN -np $np ./mat_var $dims --type $type $mode --bench | grep '^{' >> $OUT
+            done
+        done
+    done
+done
+
+echo "$(wc -l < $OUT) runs written to $OUT"
+if grep -q '"errors": [1-9]' $OUT; then
+    echo "Verification failed:"
+    grep '"errors": [1-9]' $OUT
+    exit 1
+fi
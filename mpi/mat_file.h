@@ -0,0 +1,155 @@
+#ifndef MAT_FILE_H
+#define MAT_FILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <mpi.h>
+#include "mat_kernels.h"
+#include "node_shm.h"
+
+// Binary batch files (--input, --save-input, --output), in host byte order:
+//
+//   offset  0  char[4]  magic "MATB"
+//           4  int32    version (1)
+//           8  int32    K, M, N, P
+//          24  int32    element type: 0 int32, 1 int16, 2 uint8 (ElemType)
+//          28  int32    flags: MAT_FILE_SHARED_B, MAT_FILE_RESULT
+//          32           data
+//
+// An input file holds the K A matrices (M x N) followed by the K B matrices
+// (N x P), or by one B with MAT_FILE_SHARED_B. A result file holds the K R
+// matrices (M x P) only. Every element is in [0, 100), like the generated
+// ones: the kernels (mat_kernels.h) are only exact on that range, so the
+// programs reject input files with other values (mat_file_check_values). Matrices are row-major and stored back to back, so
+// a rank reads or writes its own matrices with one collective call through a
+// file view whose unit is one whole matrix (matrix_type).
+typedef struct {
+    char magic[4];
+    int32_t version;
+    int32_t K, M, N, P;
+    int32_t type;
+    int32_t flags;
+} MatFileHeader;
+
+#define MAT_FILE_VERSION 1
+#define MAT_FILE_SHARED_B 1  // one B for every A_k
+#define MAT_FILE_RESULT 2    // R matrices instead of A and B
+
+static inline MatFileHeader mat_file_header(int K, int M, int N, int P, ElemType t, int flags) {
+    MatFileHeader h = {{'M', 'A', 'T', 'B'}, MAT_FILE_VERSION, K, M, N, P, (int32_t)t, flags};
+    return h;
+}
+
+// File offsets of the A, B and R blocks, and of the end of the file
+static inline MPI_Offset mat_file_a_disp(const MatFileHeader *h) {
+    (void)h;
+    return sizeof(MatFileHeader);
+}
+
+static inline MPI_Offset mat_file_b_disp(const MatFileHeader *h) {
+    return sizeof(MatFileHeader) + (MPI_Offset)h->K * h->M * h->N * elem_size((ElemType)h->type);
+}
+
+static inline MPI_Offset mat_file_r_disp(const MatFileHeader *h) {
+    return mat_file_a_disp(h);
+}
+
+static inline MPI_Offset mat_file_size(const MatFileHeader *h) {
+    size_t esize = elem_size((ElemType)h->type);
+    if (h->flags & MAT_FILE_RESULT) return mat_file_r_disp(h) + (MPI_Offset)h->K * h->M * h->P * esize;
+    int numB = h->flags & MAT_FILE_SHARED_B ? 1 : h->K;
+    return mat_file_b_disp(h) + (MPI_Offset)numB * h->N * h->P * esize;
+}
+
+// Opens an input file on every rank of comm and reads its header. Returns 0
+// on every rank, with a message from rank 0, if the file is missing,
+// malformed, a result file or shorter than its header says.
+static inline int mat_file_open(const char *path, MPI_Comm comm, MPI_File *fh, MatFileHeader *h) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    if (MPI_File_open(comm, path, MPI_MODE_RDONLY, MPI_INFO_NULL, fh) != MPI_SUCCESS) {
+        if (rank == 0) fprintf(stderr, "Could not open file: %s\n", path);
+        return 0;
+    }
+
+    MPI_Offset file_size;
+    memset(h, 0, sizeof(*h));
+    MPI_File_read_at_all(*fh, 0, h, sizeof(*h), MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_get_size(*fh, &file_size);
+
+    const char *error = NULL;
+    if (memcmp(h->magic, "MATB", 4) != 0 || h->version != MAT_FILE_VERSION) error = "not a version 1 matrix file";
+    else if (h->K <= 0 || h->M <= 0 || h->N <= 0 || h->P <= 0) error = "bad dimensions";
+    else if (h->type < ELEM_INT || h->type > ELEM_UINT8) error = "unknown element type";
+    else if (h->flags & MAT_FILE_RESULT) error = "a result file, not an input file";
+    else if (file_size < mat_file_size(h)) error = "truncated";
+
+    if (error) {
+        if (rank == 0) fprintf(stderr, "%s: %s\n", path, error);
+        MPI_File_close(fh);
+        return 0;
+    }
+    return 1;
+}
+
+// Creates path on every rank of comm, sized for h, with the header written
+// by rank 0. Returns 0 on every rank if the file could not be created.
+static inline int mat_file_create(const char *path, const MatFileHeader *h, MPI_Comm comm, MPI_File *fh) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    if (MPI_File_open(comm, path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, fh) != MPI_SUCCESS) {
+        if (rank == 0) fprintf(stderr, "Could not open file: %s\n", path);
+        return 0;
+    }
+    MPI_File_set_size(*fh, mat_file_size(h));
+    if (rank == 0) MPI_File_write_at(*fh, 0, h, sizeof(*h), MPI_BYTE, MPI_STATUS_IGNORE);
+    return 1;
+}
+
+// Collective read / write of count matrices of type mat, starting with
+// matrix first of the block at disp. Every rank of the file's communicator
+// must call them, with count 0 if it has nothing to move.
+static inline void mat_file_read_block(MPI_File fh, MPI_Offset disp, MPI_Datatype mat, int first, int count,
+                                       void *buf) {
+    MPI_File_set_view(fh, disp, mat, mat, "native", MPI_INFO_NULL);
+    MPI_File_read_at_all(fh, first, buf, count, mat, MPI_STATUS_IGNORE);
+}
+
+static inline void mat_file_write_block(MPI_File fh, MPI_Offset disp, MPI_Datatype mat, int first, int count,
+                                        const void *buf) {
+    MPI_File_set_view(fh, disp, mat, mat, "native", MPI_INFO_NULL);
+    MPI_File_write_at_all(fh, first, buf, count, mat, MPI_STATUS_IGNORE);
+}
+
+// Returns 1 on every rank of comm if the count_a elements at A and the
+// count_b elements at B of every rank are all in [0, 100); otherwise rank 0
+// reports path and every rank returns 0
+static inline int mat_file_check_values(const char *path, ElemType t, const void *A, size_t count_a,
+                                        const void *B, size_t count_b, MPI_Comm comm) {
+    int rank, ok = 1;
+    MPI_Comm_rank(comm, &rank);
+    for (size_t i = 0; i < count_a && ok; i++) ok = (unsigned)elem_get(t, A, i) < 100;
+    for (size_t i = 0; i < count_b && ok; i++) ok = (unsigned)elem_get(t, B, i) < 100;
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_LAND, comm);
+    if (!ok && rank == 0) fprintf(stderr, "%s: elements outside [0, 100)\n", path);
+    return ok;
+}
+
+// --input with --shm: each node leader reads the node_count matrices of its
+// node (from matrix node_first on) into one shared window; the other ranks
+// join the collective read with nothing to read. Returns the address of
+// matrix my_first inside the window.
+static inline void *node_read_block(const NodeInfo *ni, MPI_File fh, MPI_Offset disp, MPI_Datatype mat,
+                                    int node_first, int node_count, int my_first, MPI_Win *win) {
+    MPI_Aint lb, extent;
+    MPI_Type_get_extent(mat, &lb, &extent);
+
+    MPI_Aint bytes = (MPI_Aint)node_count * extent;
+    char *base = (char *)node_shared_alloc(ni, &bytes, win);
+    mat_file_read_block(fh, disp, mat, node_first, ni->node_rank == 0 ? node_count : 0, base);
+    node_shared_sync(ni, *win);
+    return base + (MPI_Aint)(my_first - node_first) * extent;
+}
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef MAT_KERNELS_H
+#define MAT_KERNELS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+// Element types of the batched multiply (--type). Every element is in
+// [0, 100) and every result is reduced % 100, so int16 and uint8 storage
+// lose nothing while cutting memory and scatter/gather volume by 2x and 4x.
+// int is the original path and stays the reference. The kernels below rely
+// on that range; --input files are checked against it (mat_file.h).
+typedef enum { ELEM_INT, ELEM_INT16, ELEM_UINT8 } ElemType;
+
+static inline int parse_elem_type(const char *name, ElemType *t) {
+    if (strcmp(name, "int") == 0) *t = ELEM_INT;
+    else if (strcmp(name, "int16") == 0) *t = ELEM_INT16;
+    else if (strcmp(name, "uint8") == 0) *t = ELEM_UINT8;
+    else return 0;
+    return 1;
+}
+
+static inline const char *elem_name(ElemType t) {
+    return t == ELEM_INT ? "int" : t == ELEM_INT16 ? "int16" : "uint8";
+}
+
+static inline size_t elem_size(ElemType t) {
+    return t == ELEM_INT ? sizeof(int) : t == ELEM_INT16 ? sizeof(int16_t) : sizeof(uint8_t);
+}
+
+static inline MPI_Datatype elem_mpi_type(ElemType t) {
+    return t == ELEM_INT ? MPI_INT : t == ELEM_INT16 ? MPI_INT16_T : MPI_UINT8_T;
+}
+
+static inline void elem_set(ElemType t, void *buf, size_t i, int v) {
+    if (t == ELEM_INT) ((int *)buf)[i] = v;
+    else if (t == ELEM_INT16) ((int16_t *)buf)[i] = (int16_t)v;
+    else ((uint8_t *)buf)[i] = (uint8_t)v;
+}
+
+static inline int elem_get(ElemType t, const void *buf, size_t i) {
+    if (t == ELEM_INT) return ((const int *)buf)[i];
+    if (t == ELEM_INT16) return ((const int16_t *)buf)[i];
+    return ((const uint8_t *)buf)[i];
+}
+
+// The narrow kernels sum products (at most 99 * 99) in 32-bit accumulators
+// and reduce them % 100 every MAT_FOLD terms, so any N gives the exact
+// result, where the int path overflows once N * 99 * 99 passes INT_MAX
+#define MAT_FOLD 65536
+
+// The original kernel, kept as the reference: R[k] = A[k] * B[k] % 100
+static inline void multiply_int(int K, int M, int N, int P, int A[K][M][N], int B[K][N][P], int R[K][M][P]) {
+    for (int k = 0; k < K; k++) {
+        for (int i = 0; i < M; i++) {
+            for (int j = 0; j < P; j++) {
+                R[k][i][j] = 0;
+                for (int l = 0; l < N; l++) {
+                    R[k][i][j] += A[k][i][l] * B[k][l][j];
+                }
+                R[k][i][j] %= 100;
+            }
+        }
+    }
+}
+
+// Row-times-matrix order: each A element scales a contiguous row of B into
+// a row of accumulators, which the compiler turns into widening SIMD
+// multiply-adds on the narrow elements (at -O3; about 8x the int path here)
+static inline void multiply_int16(int K, int M, int N, int P, const int16_t A[K][M][N], const int16_t B[K][N][P],
+                                  int16_t R[K][M][P]) {
+    uint32_t *acc = malloc(P * sizeof(uint32_t));
+    for (int k = 0; k < K; k++) {
+        for (int i = 0; i < M; i++) {
+            memset(acc, 0, P * sizeof(uint32_t));
+            for (int l = 0; l < N; l++) {
+                uint32_t a = (uint16_t)A[k][i][l];
+                const int16_t *b = B[k][l];
+                for (int j = 0; j < P; j++) acc[j] += a * (uint16_t)b[j];
+                if ((l + 1) % MAT_FOLD == 0) {
+                    for (int j = 0; j < P; j++) acc[j] %= 100;
+                }
+            }
+            for (int j = 0; j < P; j++) R[k][i][j] = acc[j] % 100;
+        }
+    }
+    free(acc);
+}
+
+static inline void multiply_uint8(int K, int M, int N, int P, const uint8_t A[K][M][N], const uint8_t B[K][N][P],
+                                  uint8_t R[K][M][P]) {
+    uint32_t *acc = malloc(P * sizeof(uint32_t));
+    for (int k = 0; k < K; k++) {
+        for (int i = 0; i < M; i++) {
+            memset(acc, 0, P * sizeof(uint32_t));
+            for (int l = 0; l < N; l++) {
+                uint32_t a = A[k][i][l];
+                const uint8_t *b = B[k][l];
+                for (int j = 0; j < P; j++) acc[j] += a * b[j];
+                if ((l + 1) % MAT_FOLD == 0) {
+                    for (int j = 0; j < P; j++) acc[j] %= 100;
+                }
+            }
+            for (int j = 0; j < P; j++) R[k][i][j] = acc[j] % 100;
+        }
+    }
+    free(acc);
+}
+
+// R[k] = A[k] * B[k] % 100 for K pairs stored as elements of type t
+static inline void multiply_batch(ElemType t, int K, int M, int N, int P, const void *A, const void *B, void *R) {
+    if (t == ELEM_INT) multiply_int(K, M, N, P, (void *)A, (void *)B, R);
+    else if (t == ELEM_INT16) multiply_int16(K, M, N, P, A, B, R);
+    else multiply_uint8(K, M, N, P, A, B, R);
+}
+
+// --shared-b: every A_k is multiplied by the same B, so the K pairs become
+// one (K * M) x N by N x P multiply. It is blocked so that GEMM_LB rows of B
+// and GEMM_IB rows of 32-bit accumulators stay in cache while they are
+// reused. The int version keeps the reference's int wrap-around; the narrow
+// ones reduce % 100 every MAT_FOLD terms like the per-pair kernels.
+#define GEMM_IB 64
+#define GEMM_LB 128  // divides MAT_FOLD
+
+#define DEFINE_GEMM_SHARED_B(name, T, FOLD)                                                 \
+    static inline void name(long rows, int N, int P, const T *A, const T *B, T *R) {        \
+        uint32_t *acc = malloc((size_t)GEMM_IB * P * sizeof(uint32_t));                     \
+        for (long i0 = 0; i0 < rows; i0 += GEMM_IB) {                                       \
+            long ib = rows - i0 < GEMM_IB ? rows - i0 : GEMM_IB;                            \
+            memset(acc, 0, ib * P * sizeof(uint32_t));                                      \
+            for (int l0 = 0; l0 < N; l0 += GEMM_LB) {                                       \
+                int lb = N - l0 < GEMM_LB ? N - l0 : GEMM_LB;                               \
+                for (long i = 0; i < ib; i++) {                                             \
+                    uint32_t *c = acc + i * P;                                              \
+                    const T *a = A + (i0 + i) * N + l0;                                     \
+                    for (int l = 0; l < lb; l++) {                                          \
+                        uint32_t x = (uint32_t)a[l];                                        \
+                        const T *b = B + (size_t)(l0 + l) * P;                              \
+                        for (int j = 0; j < P; j++) c[j] += x * (uint32_t)b[j];             \
+                    }                                                                       \
+                }                                                                           \
+                if (FOLD && (l0 + lb) % MAT_FOLD == 0) {                                    \
+                    for (long i = 0; i < ib * P; i++) acc[i] %= 100;                        \
+                }                                                                           \
+            }                                                                               \
+            for (long i = 0; i < ib * P; i++) {                                             \
+                R[i0 * P + i] = FOLD ? (T)(acc[i] % 100) : (T)((int32_t)acc[i] % 100);      \
+            }                                                                               \
+        }                                                                                   \
+        free(acc);                                                                          \
+    }
+
+DEFINE_GEMM_SHARED_B(gemm_shared_b_int, int, 0)
+DEFINE_GEMM_SHARED_B(gemm_shared_b_int16, int16_t, 1)
+DEFINE_GEMM_SHARED_B(gemm_shared_b_uint8, uint8_t, 1)
+
+// R = A * B % 100 for rows x N A (the stacked A_k) and one N x P B
+static inline void multiply_shared_b(ElemType t, long rows, int N, int P, const void *A, const void *B, void *R) {
+    if (t == ELEM_INT) gemm_shared_b_int(rows, N, P, A, B, R);
+    else if (t == ELEM_INT16) gemm_shared_b_int16(rows, N, P, A, B, R);
+    else gemm_shared_b_uint8(rows, N, P, A, B, R);
+}
+
+#endif
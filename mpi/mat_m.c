@@ -1,17 +1,24 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <mpi.h>
+#include "node_shm.h"
+#include "large_count.h"
+#include "mat_kernels.h"
+#include "mat_bench.h"
+#include "mat_file.h"
+#include "perf_counters.h"
 
 // Function to print a matrix
-void display(int rows, int cols, int matrix[rows][cols]) {
+void display(int rows, int cols, ElemType t, const void *matrix) {
     for (int i = 0; i < rows; i++) {
         for (int j = 0; j < cols; j++) {
-            printf("%3d ", matrix[i][j]);
+            printf("%3d ", elem_get(t, matrix, (size_t)i * cols + j));
         }
         printf("\n");
     }
     printf("\n");
-}   
+}
 
 int main(int argc, char **argv) {
     MPI_Init(&argc, &argv);
@@ -21,23 +28,62 @@ int main(int argc, char **argv) {
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
     int K = 120, M = 100, N = 100, P = 100;
-    /*
-    // Check conmand Line argunents
-    if (argc < 5) {
-    if (rank == 0) {
-        printf("mpirun -np 4 ./fileName  <K> <M> <N> <P>");
-        MPI_Finalize();
-        return 1;
-    }
-
-    int K = atoi(argv[1]);
-    int M = atoi(argv[2]);
-    int N = atoi(argv[3]);
-    int P = atoi(argv[4]);
-
-    */
 
+    // Optional arguments: K M N P (the defaults above), then
+    // --shm: one copy of A and B per node, in MPI shared memory
+    // --type: element type of A, B and R (int, int16 or uint8)
+    // --bench: check sampled results and print one JSON line of metrics
+    // --shared-b: one B for every A_k, broadcast instead of scattered
+    // --input: read A and B from a batch file (see mat_file.h), which also
+    //          gives K M N P, the type and --shared-b
+    // --save-input / --output: write the generated A and B / the result R
+    // --perf: hardware counters around the local multiply (perf_counters.h)
+    int use_shm = 0, bench = 0, shared_b = 0, use_perf = 0, nargs = 0;
+    int *dims[4] = {&K, &M, &N, &P};
+    ElemType etype = ELEM_INT;
+    const char *input = NULL, *save_input = NULL, *output = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--input") == 0 && i + 1 < argc && !save_input) {
+            input = argv[++i];
+        } else if (strcmp(argv[i], "--save-input") == 0 && i + 1 < argc && !input) {
+            save_input = argv[++i];
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "--shm") == 0) {
+            use_shm = 1;
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            use_perf = 1;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            bench = 1;
+        } else if (strcmp(argv[i], "--shared-b") == 0) {
+            shared_b = 1;
+        } else if (strcmp(argv[i], "--type") == 0 && i + 1 < argc && parse_elem_type(argv[i + 1], &etype)) {
+            i++;
+        } else if (argv[i][0] != '-' && nargs < 4 && atoi(argv[i]) > 0) {
+            *dims[nargs++] = atoi(argv[i]);
+        } else {
+            if (rank == 0)
+                fprintf(stderr, "Usage: %s [K M N P] [--shm] [--type int|int16|uint8] [--bench] [--shared-b]"
+                                " [--input <file> | --save-input <file>] [--output <file>] [--perf]\n", argv[0]);
+            MPI_Finalize();
+            return 1;
+        }
+    }
 
+    MPI_File in_file = MPI_FILE_NULL;
+    MatFileHeader in_header;
+    if (input) {
+        if (!mat_file_open(input, MPI_COMM_WORLD, &in_file, &in_header)) {
+            MPI_Finalize();
+            return 1;
+        }
+        K = in_header.K;
+        M = in_header.M;
+        N = in_header.N;
+        P = in_header.P;
+        etype = (ElemType)in_header.type;
+        shared_b = (in_header.flags & MAT_FILE_SHARED_B) != 0;
+    }
 
     MPI_Bcast(&K, 1, MPI_INT, 0, MPI_COMM_WORLD);
     MPI_Bcast(&M, 1, MPI_INT, 0, MPI_COMM_WORLD);
@@ -47,6 +93,7 @@ int main(int argc, char **argv) {
     if (K % size != 0) {
         if (rank == 0)
             printf("Error: K (%d) must be divisible by number of processes (%d).\n", K, size);
+        if (input) MPI_File_close(&in_file);
         MPI_Finalize();
         return 1;
     }
@@ -54,35 +101,50 @@ int main(int argc, char **argv) {
     int localK = K / size;   // number of matrices per process
 
 
-    int (*A)[M][N] = NULL;
-    int (*B)[N][P] = NULL;
-    int (*R)[M][P] = NULL;
+    size_t esize = elem_size(etype);
+    MPI_Datatype mpi_elem = elem_mpi_type(etype);
+    size_t sizeA = (size_t)M * N, sizeB = (size_t)N * P, sizeR = (size_t)M * P;
 
-    if (rank == 0) {
-        A = malloc(K * sizeof(*A));
-        B = malloc(K * sizeof(*B));
-        R = malloc(K * sizeof(*R));
+    // Counts are in whole matrices, so K * M * N elements may pass INT_MAX
+    MPI_Datatype matA = matrix_type(M, N, mpi_elem);
+    MPI_Datatype matB = matrix_type(N, P, mpi_elem);
+    MPI_Datatype matR = matrix_type(M, P, mpi_elem);
+
+    void *A = NULL;
+    void *B = NULL;
+    void *R = NULL;
+
+    // With --input the root holds none of A, B and R: every rank reads its
+    // own pairs and keeps (or, with --output, writes) its own results
+    if (rank == 0 && !input) {
+        A = malloc(K * sizeA * esize);
+        B = malloc((shared_b ? 1 : K) * sizeB * esize);
+        R = malloc(K * sizeR * esize);
+        if (!A || !B || !R) {
+            fprintf(stderr, "Error: could not allocate %.2f GB for A, B and R.\n",
+                    (K * (sizeA + sizeR) + (shared_b ? 1 : K) * sizeB) * esize / 1e9);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
 
-        // Initialize
+        // Initialize random matrices (the same values for every --type)
         for (int k = 0; k < K; k++) {
-            for (int i = 0; i < M; i++) {
-                for (int j = 0; j < N; j++) {
-                    A[k][i][j] = rand() % 100;
-                    
-                }
+            for (size_t i = 0; i < sizeA; i++) {
+                elem_set(etype, A, k * sizeA + i, rand() % 100);
             }
-            for (int i = 0; i < N; i++) {
-                for (int j = 0; j < P; j++) {
-                    B[k][i][j] = rand() % 100;
-                }
+            for (size_t i = 0; i < sizeB && !shared_b; i++) {
+                elem_set(etype, B, k * sizeB + i, rand() % 100);
             }
         }
+        // --shared-b: a single B, generated once
+        for (size_t i = 0; i < sizeB && shared_b; i++) {
+            elem_set(etype, B, i, rand() % 100);
+        }
 
         // If you want to see the initialization of matrix
         // for (int k = 0; k < 1; k++) {
         //     for (int i = 0; i < M; i++) {
         //         for (int j = 0; j < N; j++) {
-        //             printf("%d ", B[k][i][j]);
+        //             printf("%d ", elem_get(etype, B, k * sizeB + (size_t)i * P + j));
                     
         //         } printf("\n");
         //     }
@@ -90,54 +152,155 @@ int main(int argc, char **argv) {
         // }
     }
 
+    if (save_input) {
+        MatFileHeader h = mat_file_header(K, M, N, P, etype, shared_b ? MAT_FILE_SHARED_B : 0);
+        MPI_File fh;
+        if (mat_file_create(save_input, &h, MPI_COMM_WORLD, &fh)) {
+            mat_file_write_block(fh, mat_file_a_disp(&h), matA, 0, rank == 0 ? K : 0, A);
+            mat_file_write_block(fh, mat_file_b_disp(&h), matB, 0, rank == 0 ? (shared_b ? 1 : K) : 0, B);
+            MPI_File_close(&fh);
+        }
+    }
+
+    NodeInfo node;
+    MPI_Win winA = MPI_WIN_NULL, winB = MPI_WIN_NULL;
+    if (use_shm && !node_info_init(&node)) {
+        if (rank == 0) fprintf(stderr, "--shm needs node-contiguous rank placement; using per-rank copies\n");
+        use_shm = 0;
+    }
+
     // Allocate local arrays (only what each process needs)
-    int (*localA)[M][N] = malloc(localK * M * N * sizeof(int));
-    int (*localB)[N][P] = malloc(localK * M * N * sizeof(int));
-    int (*localR)[M][P] = malloc(localK * M * N * sizeof(int));
+    void *localA;
+    void *localB;
+    void *localR = malloc(localK * sizeR * esize);
 
-    // Distribute data
-    MPI_Scatter(A, localK * M * N, MPI_INT, localA, localK * M * N, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Scatter(B, localK * N * P, MPI_INT, localB, localK * N * P, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Barrier(MPI_COMM_WORLD);
+    double scatterStart = MPI_Wtime();
 
-    //MPI_Barrier(MPI_COMM_WORLD);
-    double startTime = MPI_Wtime();
+    if (use_shm && input) {
+        // Each node leader reads the matrices of its node into shared memory
+        MPI_Offset dispA = mat_file_a_disp(&in_header), dispB = mat_file_b_disp(&in_header);
+        int nodeFirst = node.first_rank * localK, nodeK = node.node_size * localK;
+        localA = node_read_block(&node, in_file, dispA, matA, nodeFirst, nodeK, rank * localK, &winA);
+        if (shared_b) localB = node_read_block(&node, in_file, dispB, matB, 0, 1, 0, &winB);
+        else localB = node_read_block(&node, in_file, dispB, matB, nodeFirst, nodeK, rank * localK, &winB);
+    } else if (use_shm) {
+        // Every rank gets localK pairs, so the node parts follow from rank order
+        int *counts = malloc(size * sizeof(int)), *displs = malloc(size * sizeof(int));
+        for (int i = 0; i < size; i++) {
+            counts[i] = localK;
+            displs[i] = i * localK;
+        }
+        localA = node_scatterv(&node, A, counts, displs, matA, &winA);
+        if (shared_b) localB = node_bcast(&node, B, 1, matB, &winB);
+        else localB = node_scatterv(&node, B, counts, displs, matB, &winB);
+        free(counts);
+        free(displs);
+    } else {
+        localA = malloc(localK * sizeA * esize);
+        localB = malloc((shared_b ? 1 : localK) * sizeB * esize);
 
-    // Local multiplication
-    for (int k = 0; k < localK; k++) {
-        for (int i = 0; i < M; i++) {
-            for (int j = 0; j < P; j++) {
-                localR[k][i][j] = 0;
-                for (int l = 0; l < N; l++) {
-                    localR[k][i][j] += (localA[k][i][l] * localB[k][l][j]) ;
-                }
-                localR[k][i][j] %= 100;
+        if (input) {
+            // Every rank reads exactly its own matrices, with no root staging
+            mat_file_read_block(in_file, mat_file_a_disp(&in_header), matA, rank * localK, localK, localA);
+            mat_file_read_block(in_file, mat_file_b_disp(&in_header), matB, shared_b ? 0 : rank * localK,
+                                shared_b ? 1 : localK, localB);
+        } else {
+            // Distribute data
+            MPI_Scatter(A, localK, matA, localA, localK, matA, 0, MPI_COMM_WORLD);
+            if (shared_b) {
+                if (rank == 0) memcpy(localB, B, sizeB * esize);
+                MPI_Bcast(localB, 1, matB, 0, MPI_COMM_WORLD);
+            } else {
+                MPI_Scatter(B, localK, matB, localB, localK, matB, 0, MPI_COMM_WORLD);
             }
         }
     }
+    if (input) MPI_File_close(&in_file);
+
+    // The kernels are only exact for elements in [0, 100), so a file with
+    // other values is rejected rather than multiplied into wrong results
+    int status = 0;
+    if (input && !mat_file_check_values(input, etype, localA, localK * sizeA, localB,
+                                        (shared_b ? 1 : localK) * sizeB, MPI_COMM_WORLD)) {
+        status = 1;
+        goto done;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    PerfCounters perf = {{0}, 0};
+    if (use_perf) perf_start(&perf);
+    double startTime = MPI_Wtime();
+
+    // Local multiplication; with --shared-b the local A matrices are one
+    // (localK * M) x N block times B
+    if (shared_b) multiply_shared_b(etype, (long)localK * M, N, P, localA, localB, localR);
+    else multiply_batch(etype, localK, M, N, P, localA, localB, localR);
 
     double endTime = MPI_Wtime();
+    if (use_perf) {
+        long long counts[PERF_EVENTS];
+        perf_stop(&perf, counts);
+        report_perf("local multiply", &perf, counts, (double)localK * M * N * P, "multiply-add", MPI_COMM_WORLD);
+    }
     MPI_Barrier(MPI_COMM_WORLD);
 
-    // Gather results back
-    MPI_Gather(localR, localK * M * P, MPI_INT, R, localK * M * P, MPI_INT, 0, MPI_COMM_WORLD);
+    // Gather results back (not with --input, where R stays distributed)
+    double gatherStart = MPI_Wtime();
+    if (!input) MPI_Gather(localR, localK, matR, R, localK, matR, 0, MPI_COMM_WORLD);
+    double gatherEnd = MPI_Wtime();
+
+    // --output: every rank writes its own R matrices
+    if (output) {
+        MatFileHeader h = mat_file_header(K, M, N, P, etype, MAT_FILE_RESULT);
+        MPI_File fh;
+        if (mat_file_create(output, &h, MPI_COMM_WORLD, &fh)) {
+            mat_file_write_block(fh, mat_file_r_disp(&h), matR, rank * localK, localK, localR);
+            MPI_File_close(&fh);
+        }
+    }
 
     // Print timing
     printf("Process %d: Time taken = %f seconds\n", rank, endTime - startTime);
 
+    if (bench) {
+        // With --input only the ranks hold A and B, so each checks its own pairs
+        long errors = 0;
+        int samples = input ? BENCH_SAMPLES * size : BENCH_SAMPLES;
+        if (input) {
+            long mine = verify_sample(etype, localK, M, N, P, localA, localB, shared_b, localR, BENCH_SAMPLES);
+            MPI_Reduce(&mine, &errors, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        } else if (rank == 0) {
+            errors = verify_sample(etype, K, M, N, P, A, B, shared_b, R, BENCH_SAMPLES);
+        }
+        MatTimes times = {startTime - scatterStart, endTime - startTime, input ? 0 : gatherEnd - gatherStart};
+        report_bench("mat_m", etype, use_shm, shared_b, K, M, N, P, times, errors, samples);
+    }
+
     // Uncomment to print results
     /*
     if (rank == 0) {
         for (int k = 0; k < K; k++) {
             printf("Result Matrix R%d:\n", k);
-            display(M, P, R[k]);
+            display(M, P, etype, (char *)R + k * sizeR * esize);
         }
     }
     */
 
+done:
     // Free memory
-    free(localA);
-    free(localB);
+    if (use_shm) {
+        node_shared_free(&winA);
+        node_shared_free(&winB);
+        node_info_free(&node);
+    } else {
+        free(localA);
+        free(localB);
+    }
     free(localR);
+    MPI_Type_free(&matA);
+    MPI_Type_free(&matB);
+    MPI_Type_free(&matR);
     if (rank == 0) {
         free(A);
         free(B);
@@ -145,13 +308,18 @@ int main(int argc, char **argv) {
     }
 
     MPI_Finalize();
-    return 0;
+    return status;
 }
 
 
 
-// mpicc helllo.c -o hello
-// mpirun -np 4 ./hello 
+// mpicc mat_m.c -o mat_m
+// mpirun -np 4 ./mat_m
+// mpirun -np 4 ./mat_m 240 64 64 64 --type uint8 --bench
+// mpirun -np 4 ./mat_m 240 64 64 64 --shared-b --bench
+// mpirun -np 4 ./mat_m 240 64 64 64 --type uint8 --save-input batch.bin
+// mpirun -np 4 ./mat_m --input batch.bin --output result.bin
+// mpirun -np 4 ./mat_m 24 256 256 256 --type int16 --perf
 
 /*
 MPI Library (e.g., OpenMPI) installation:
@@ -1,18 +1,114 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <mpi.h>
+#include "node_shm.h"
+#include "large_count.h"
+#include "mat_kernels.h"
+#include "mat_bench.h"
+#include "mat_file.h"
+#include "perf_counters.h"
 
 // Function to print a matrix
-void display(int rows, int cols, int matrix[rows][cols]) {
+void display(int rows, int cols, ElemType t, const void *matrix) {
     for (int i = 0; i < rows; i++) {
         for (int j = 0; j < cols; j++) {
-            printf("%3d ", matrix[i][j]);
+            printf("%3d ", elem_get(t, matrix, (size_t)i * cols + j));
         }
         printf("\n");
     }
     printf("\n");
 }
 
+// Pairs per second this rank multiplies, timed on a small batch of the job's
+// matrix shape and element type with the kernel the job uses (best of 3
+// runs). The probe data does not come from rand(), so the job's matrices
+// stay the same.
+double probe_throughput(ElemType t, int M, int N, int P, int shared_b) {
+    double ops = 2.0 * M * N * P;
+    int probeK = ops >= 2e7 ? 1 : (int)(2e7 / ops);
+    if (probeK > 64) probeK = 64;
+
+    size_t esize = elem_size(t);
+    size_t sizeA = (size_t)probeK * M * N, sizeB = (size_t)(shared_b ? 1 : probeK) * N * P;
+    void *a = malloc(sizeA * esize);
+    void *b = malloc(sizeB * esize);
+    void *r = malloc((size_t)probeK * M * P * esize);
+    for (size_t i = 0; i < sizeA; i++) elem_set(t, a, i, (i * 7 + 3) % 100);
+    for (size_t i = 0; i < sizeB; i++) elem_set(t, b, i, (i * 11 + 5) % 100);
+
+    double best = 1e30;
+    for (int rep = 0; rep < 3; rep++) {
+        double start = MPI_Wtime();
+        if (shared_b) multiply_shared_b(t, (long)probeK * M, N, P, a, b, r);
+        else multiply_batch(t, probeK, M, N, P, a, b, r);
+        double elapsed = MPI_Wtime() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    free(a);
+    free(b);
+    free(r);
+    return probeK / (best > 1e-9 ? best : 1e-9);
+}
+
+// Calibration file: a "ranks <size> shape <M> <N> <P> type <type> shared_b
+// <0|1>" line, then "<rank> <pairs per second>" per rank. Returns 0 if the
+// file is missing or was probed for another rank count, shape, element type
+// or kernel.
+int load_calibration(const char *path, int size, int M, int N, int P, ElemType t, int shared_b, double *speed) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    int ranks = 0, m = 0, n = 0, p = 0, sb = -1;
+    char type[16];
+    ElemType ft;
+    int ok = fscanf(f, "ranks %d shape %d %d %d type %15s shared_b %d", &ranks, &m, &n, &p, type, &sb) == 6 &&
+             ranks == size && m == M && n == N && p == P && parse_elem_type(type, &ft) && ft == t &&
+             sb == shared_b;
+    for (int i = 0; ok && i < size; i++) {
+        int r;
+        ok = fscanf(f, "%d %lf", &r, &speed[i]) == 2 && r == i && speed[i] > 0;
+    }
+    fclose(f);
+    return ok;
+}
+
+void save_calibration(const char *path, int size, int M, int N, int P, ElemType t, int shared_b,
+                      const double *speed) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Could not write calibration file: %s\n", path);
+        return;
+    }
+    fprintf(f, "ranks %d shape %d %d %d type %s shared_b %d\n", size, M, N, P, elem_name(t), shared_b);
+    for (int i = 0; i < size; i++) fprintf(f, "%d %f\n", i, speed[i]);
+    fclose(f);
+}
+
+// Splits K pairs in proportion to rank speed, handing the leftover pairs to
+// the largest fractional shares, so every rank needs about the same time
+void weighted_counts(int K, int size, const double *speed, int *kcount) {
+    double total = 0;
+    for (int i = 0; i < size; i++) total += speed[i];
+
+    double *share = malloc(size * sizeof(double));
+    int assigned = 0;
+    for (int i = 0; i < size; i++) {
+        share[i] = K * speed[i] / total;
+        kcount[i] = (int)share[i];
+        share[i] -= kcount[i];
+        assigned += kcount[i];
+    }
+    for (; assigned < K; assigned++) {
+        int best = 0;
+        for (int i = 1; i < size; i++) {
+            if (share[i] > share[best]) best = i;
+        }
+        kcount[best]++;
+        share[best] = -1;
+    }
+    free(share);
+}
+
 int main(int argc, char **argv) {
     MPI_Init(&argc, &argv);
 
@@ -20,136 +116,318 @@ int main(int argc, char **argv) {
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
+    // Options may come anywhere; the other arguments are K M N P, which
+    // --input takes from the file header instead (along with the type and
+    // --shared-b)
+    int use_shm = 0, bench = 0, shared_b = 0, calibrate = 0, use_perf = 0, nargs = 0, bad_option = 0;
+    ElemType etype = ELEM_INT;
+    const char *calib_file = NULL, *input = NULL, *save_input = NULL, *output = NULL;
+    char *args[4];
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--shm") == 0) use_shm = 1;
+        else if (strcmp(argv[i], "--bench") == 0) bench = 1;
+        else if (strcmp(argv[i], "--perf") == 0) use_perf = 1;
+        else if (strcmp(argv[i], "--shared-b") == 0) shared_b = 1;
+        else if (strcmp(argv[i], "--calibrate") == 0) calibrate = 1;
+        else if (strcmp(argv[i], "--calib-file") == 0) {
+            if (i + 1 < argc) calib_file = argv[++i];
+            else bad_option = 1;
+        }
+        else if (strcmp(argv[i], "--input") == 0) {
+            if (i + 1 < argc) input = argv[++i];
+            else bad_option = 1;
+        }
+        else if (strcmp(argv[i], "--save-input") == 0) {
+            if (i + 1 < argc) save_input = argv[++i];
+            else bad_option = 1;
+        }
+        else if (strcmp(argv[i], "--output") == 0) {
+            if (i + 1 < argc) output = argv[++i];
+            else bad_option = 1;
+        }
+        else if (strcmp(argv[i], "--type") == 0) bad_option |= i + 1 >= argc || !parse_elem_type(argv[++i], &etype);
+        else if (argv[i][0] != '-' && nargs < 4 && atoi(argv[i]) > 0) args[nargs++] = argv[i];
+        else bad_option = 1;  // an unknown option, a 5th argument or a size that is not positive
+    }
+
     // Expect 4 arguments: K M N P
-    if (argc < 5) {
+    if ((nargs < 4 && !input) || (input && save_input) || bad_option) {
         if (rank == 0) {
-            fprintf(stderr, "Usage: %s K M N P\n", argv[0]);
+            fprintf(stderr, "Usage: %s K M N P [--shm] [--type int|int16|uint8] [--bench] [--shared-b]"
+                            " [--calibrate] [--calib-file <file>] [--save-input <file>] [--output <file>]"
+                            " [--perf]\n", argv[0]);
+            fprintf(stderr, "       %s --input <file> [options]\n", argv[0]);
             fprintf(stderr, "Example: mpirun -np 4 %s 500 100 100 100\n", argv[0]);
         }
         MPI_Finalize();
         return 1;
     }
 
-    int K = atoi(argv[1]); // number of matrix pairs
-    int M = atoi(argv[2]); // rows of A
-    int N = atoi(argv[3]); // cols of A / rows of B
-    int P = atoi(argv[4]); // cols of B
+    MPI_File in_file = MPI_FILE_NULL;
+    MatFileHeader in_header;
+    if (input && !mat_file_open(input, MPI_COMM_WORLD, &in_file, &in_header)) {
+        MPI_Finalize();
+        return 1;
+    }
+
+    int K = input ? in_header.K : atoi(args[0]); // number of matrix pairs
+    int M = input ? in_header.M : atoi(args[1]); // rows of A
+    int N = input ? in_header.N : atoi(args[2]); // cols of A / rows of B
+    int P = input ? in_header.P : atoi(args[3]); // cols of B
+    if (input) {
+        etype = (ElemType)in_header.type;
+        shared_b = (in_header.flags & MAT_FILE_SHARED_B) != 0;
+    }
 
     MPI_Bcast(&K, 1, MPI_INT, 0, MPI_COMM_WORLD);
     MPI_Bcast(&M, 1, MPI_INT, 0, MPI_COMM_WORLD);
     MPI_Bcast(&N, 1, MPI_INT, 0, MPI_COMM_WORLD);
     MPI_Bcast(&P, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
-    int (*A)[M][N] = NULL;
-    int (*B)[N][P] = NULL;
-    int (*R)[M][P] = NULL;
+    size_t esize = elem_size(etype);
+    MPI_Datatype mpi_elem = elem_mpi_type(etype);
+    size_t sizeA = (size_t)M * N, sizeB = (size_t)N * P, sizeR = (size_t)M * P;
 
-    if (rank == 0) {
-        A = malloc(K * sizeof(*A));
-        B = malloc(K * sizeof(*B));
-        R = malloc(K * sizeof(*R));
+    void *A = NULL;
+    void *B = NULL;
+    void *R = NULL;
+
+    // With --input the root holds none of A, B and R: every rank reads its
+    // own pairs and keeps (or, with --output, writes) its own results
+    if (rank == 0 && !input) {
+        A = malloc(K * sizeA * esize);
+        B = malloc((shared_b ? 1 : K) * sizeB * esize);
+        R = malloc(K * sizeR * esize);
+        if (!A || !B || !R) {
+            fprintf(stderr, "Error: could not allocate %.2f GB for A, B and R.\n",
+                    (K * (sizeA + sizeR) + (shared_b ? 1 : K) * sizeB) * esize / 1e9);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
 
-        // Initialize random matrices
+        // Initialize random matrices (the same values for every --type)
         for (int k = 0; k < K; k++) {
-            for (int i = 0; i < M; i++) {
-                for (int j = 0; j < N; j++) {
-                    A[k][i][j] = rand() % 100;
-                }
+            for (size_t i = 0; i < sizeA; i++) {
+                elem_set(etype, A, k * sizeA + i, rand() % 100);
+            }
+            for (size_t i = 0; i < sizeB && !shared_b; i++) {
+                elem_set(etype, B, k * sizeB + i, rand() % 100);
             }
-            for (int i = 0; i < N; i++) {
-                for (int j = 0; j < P; j++) {
-                    B[k][i][j] = rand() % 100;
-                }
+        }
+        // --shared-b: a single B, generated once
+        for (size_t i = 0; i < sizeB && shared_b; i++) {
+            elem_set(etype, B, i, rand() % 100);
+        }
+    }
+
+    // --calibrate times every rank on a small batch and splits K in
+    // proportion to speed; --calib-file reuses the figures of an earlier run
+    // with the same ranks, shape, type and kernel (or saves them, if the file
+    // is missing, was probed for another job or --calibrate is given)
+    int *kcount = NULL;
+    if (calibrate || calib_file) {
+        double *speed = malloc(size * sizeof(double));
+        int loaded = 0;
+        if (rank == 0 && calib_file && !calibrate) {
+            loaded = load_calibration(calib_file, size, M, N, P, etype, shared_b, speed);
+        }
+        MPI_Bcast(&loaded, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+        if (loaded) {
+            MPI_Bcast(speed, size, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+        } else {
+            double mine = probe_throughput(etype, M, N, P, shared_b);
+            MPI_Allgather(&mine, 1, MPI_DOUBLE, speed, 1, MPI_DOUBLE, MPI_COMM_WORLD);
+            if (rank == 0 && calib_file) save_calibration(calib_file, size, M, N, P, etype, shared_b, speed);
+        }
+
+        kcount = malloc(size * sizeof(int));
+        weighted_counts(K, size, speed, kcount);
+        if (rank == 0) {
+            for (int i = 0; i < size; i++) {
+                printf("Rank %d: %.1f pairs/s (%s), %d pairs\n", i, speed[i], loaded ? "loaded" : "probed", kcount[i]);
             }
         }
+        free(speed);
     }
 
-    // Compute counts and displacements
+    // Compute counts and displacements, in whole matrices so that K * M * N
+    // elements may pass INT_MAX; A, B and R share them through their types
     int baseK = K / size;
     int remainder = K % size;
 
-    int *sendcountsA = malloc(size * sizeof(int));
-    int *displsA     = malloc(size * sizeof(int));
-    int *sendcountsB = malloc(size * sizeof(int));
-    int *displsB     = malloc(size * sizeof(int));
-    int *sendcountsR = malloc(size * sizeof(int));
-    int *displsR     = malloc(size * sizeof(int));
+    MPI_Datatype matA = matrix_type(M, N, mpi_elem);
+    MPI_Datatype matB = matrix_type(N, P, mpi_elem);
+    MPI_Datatype matR = matrix_type(M, P, mpi_elem);
 
-    int offsetA = 0, offsetB = 0, offsetR = 0;
+    int *sendcounts = malloc(size * sizeof(int));
+    int *displs     = malloc(size * sizeof(int));
+
+    int offset = 0;
     for (int i = 0; i < size; i++) {
-        int myK = baseK + (i < remainder ? 1 : 0);
-        sendcountsA[i] = myK * M * N;
-        sendcountsB[i] = myK * N * P;
-        sendcountsR[i] = myK * M * P;
-        displsA[i] = offsetA;
-        displsB[i] = offsetB;
-        displsR[i] = offsetR;
-        offsetA += sendcountsA[i];
-        offsetB += sendcountsB[i];
-        offsetR += sendcountsR[i];
+        sendcounts[i] = kcount ? kcount[i] : baseK + (i < remainder ? 1 : 0);
+        displs[i] = offset;
+        offset += sendcounts[i];
+    }
+
+    int localK = kcount ? kcount[rank] : baseK + (rank < remainder ? 1 : 0);
+
+    if (save_input) {
+        MatFileHeader h = mat_file_header(K, M, N, P, etype, shared_b ? MAT_FILE_SHARED_B : 0);
+        MPI_File fh;
+        if (mat_file_create(save_input, &h, MPI_COMM_WORLD, &fh)) {
+            mat_file_write_block(fh, mat_file_a_disp(&h), matA, 0, rank == 0 ? K : 0, A);
+            mat_file_write_block(fh, mat_file_b_disp(&h), matB, 0, rank == 0 ? (shared_b ? 1 : K) : 0, B);
+            MPI_File_close(&fh);
+        }
     }
 
-    int localK = baseK + (rank < remainder ? 1 : 0);
+    // --shm needs the ranks of each node numbered contiguously
+    NodeInfo node;
+    MPI_Win winA = MPI_WIN_NULL, winB = MPI_WIN_NULL;
+    if (use_shm && !node_info_init(&node)) {
+        if (rank == 0) fprintf(stderr, "--shm needs node-contiguous rank placement; using per-rank copies\n");
+        use_shm = 0;
+    }
 
     // Allocate local arrays
-    int (*localA)[M][N] = malloc(localK * sizeof(*localA));
-    int (*localB)[N][P] = malloc(localK * sizeof(*localB));
-    int (*localR)[M][P] = malloc(localK * sizeof(*localR));
+    void *localA;
+    void *localB;
+    void *localR = malloc(localK * sizeR * esize);
 
-    // Scatter with variable counts
-    MPI_Scatterv(A, sendcountsA, displsA, MPI_INT,
-                 localA, sendcountsA[rank], MPI_INT,
-                 0, MPI_COMM_WORLD);
+    MPI_Barrier(MPI_COMM_WORLD);
+    double scatterStart = MPI_Wtime();
 
-    MPI_Scatterv(B, sendcountsB, displsB, MPI_INT,
-                 localB, sendcountsB[rank], MPI_INT,
-                 0, MPI_COMM_WORLD);
+    if (use_shm && input) {
+        // Each node leader reads the matrices of its node into shared memory
+        MPI_Offset dispA = mat_file_a_disp(&in_header), dispB = mat_file_b_disp(&in_header);
+        int nodeFirst = displs[node.first_rank], nodeK = 0;
+        for (int i = node.first_rank; i < node.first_rank + node.node_size; i++) nodeK += sendcounts[i];
+        localA = node_read_block(&node, in_file, dispA, matA, nodeFirst, nodeK, displs[rank], &winA);
+        if (shared_b) localB = node_read_block(&node, in_file, dispB, matB, 0, 1, 0, &winB);
+        else localB = node_read_block(&node, in_file, dispB, matB, nodeFirst, nodeK, displs[rank], &winB);
+    } else if (use_shm) {
+        // Each node receives its A and B matrices once, into shared memory,
+        // and every rank multiplies its own pairs in place
+        localA = node_scatterv(&node, A, sendcounts, displs, matA, &winA);
+        if (shared_b) localB = node_bcast(&node, B, 1, matB, &winB);
+        else localB = node_scatterv(&node, B, sendcounts, displs, matB, &winB);
+    } else {
+        localA = malloc(localK * sizeA * esize);
+        localB = malloc((shared_b ? 1 : localK) * sizeB * esize);
 
-    double startTime = MPI_Wtime();
+        if (input) {
+            // Every rank reads exactly its own matrices, with no root staging
+            mat_file_read_block(in_file, mat_file_a_disp(&in_header), matA, displs[rank], localK, localA);
+            mat_file_read_block(in_file, mat_file_b_disp(&in_header), matB, shared_b ? 0 : displs[rank],
+                                shared_b ? 1 : localK, localB);
+        } else {
+            // Scatter with variable counts
+            MPI_Scatterv(A, sendcounts, displs, matA,
+                         localA, localK, matA,
+                         0, MPI_COMM_WORLD);
 
-    // Local multiplication
-    for (int k = 0; k < localK; k++) {
-        for (int i = 0; i < M; i++) {
-            for (int j = 0; j < P; j++) {
-                localR[k][i][j] = 0;
-                for (int l = 0; l < N; l++) {
-                    localR[k][i][j] += localA[k][i][l] * localB[k][l][j];
-                }
-                localR[k][i][j] %= 100; // optional modulo
+            if (shared_b) {
+                if (rank == 0) memcpy(localB, B, sizeB * esize);
+                MPI_Bcast(localB, 1, matB, 0, MPI_COMM_WORLD);
+            } else {
+                MPI_Scatterv(B, sendcounts, displs, matB,
+                             localB, localK, matB,
+                             0, MPI_COMM_WORLD);
             }
         }
     }
+    if (input) MPI_File_close(&in_file);
+
+    // The kernels are only exact for elements in [0, 100), so a file with
+    // other values is rejected rather than multiplied into wrong results
+    int status = 0;
+    if (input && !mat_file_check_values(input, etype, localA, localK * sizeA, localB,
+                                        (shared_b ? 1 : localK) * sizeB, MPI_COMM_WORLD)) {
+        status = 1;
+        goto done;
+    }
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    PerfCounters perf = {{0}, 0};
+    if (use_perf) perf_start(&perf);
+    double startTime = MPI_Wtime();
+
+    // Local multiplication; with --shared-b the local A matrices are one
+    // (localK * M) x N block times B
+    if (shared_b) multiply_shared_b(etype, (long)localK * M, N, P, localA, localB, localR);
+    else multiply_batch(etype, localK, M, N, P, localA, localB, localR);
 
     double endTime = MPI_Wtime();
+    if (use_perf) {
+        long long counts[PERF_EVENTS];
+        perf_stop(&perf, counts);
+        report_perf("local multiply", &perf, counts, (double)localK * M * N * P, "multiply-add", MPI_COMM_WORLD);
+    }
     MPI_Barrier(MPI_COMM_WORLD);
 
-    // Gather results back
-    MPI_Gatherv(localR, sendcountsR[rank], MPI_INT,
-                R, sendcountsR, displsR, MPI_INT,
-                0, MPI_COMM_WORLD);
+    // Gather results back (not with --input, where R stays distributed)
+    double gatherStart = MPI_Wtime();
+    if (!input) {
+        MPI_Gatherv(localR, localK, matR,
+                    R, sendcounts, displs, matR,
+                    0, MPI_COMM_WORLD);
+    }
+    double gatherEnd = MPI_Wtime();
+
+    // --output: every rank writes its own R matrices
+    if (output) {
+        MatFileHeader h = mat_file_header(K, M, N, P, etype, MAT_FILE_RESULT);
+        MPI_File fh;
+        if (mat_file_create(output, &h, MPI_COMM_WORLD, &fh)) {
+            mat_file_write_block(fh, mat_file_r_disp(&h), matR, displs[rank], localK, localR);
+            MPI_File_close(&fh);
+        }
+    }
 
     // Print timing
     printf("Process %d: Time taken = %f seconds\n", rank, endTime - startTime);
 
+    if (bench) {
+        // With --input only the ranks hold A and B, so each checks its own pairs
+        long errors = 0;
+        int samples = input ? BENCH_SAMPLES * size : BENCH_SAMPLES;
+        if (input) {
+            long mine = localK > 0 ? verify_sample(etype, localK, M, N, P, localA, localB, shared_b, localR,
+                                                   BENCH_SAMPLES) : 0;
+            MPI_Reduce(&mine, &errors, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        } else if (rank == 0) {
+            errors = verify_sample(etype, K, M, N, P, A, B, shared_b, R, BENCH_SAMPLES);
+        }
+        MatTimes times = {startTime - scatterStart, endTime - startTime, input ? 0 : gatherEnd - gatherStart};
+        report_bench("mat_variable", etype, use_shm, shared_b, K, M, N, P, times, errors, samples);
+    }
+
     /*
     if (rank == 0) {
         for (int k = 0; k < K; k++) {
             printf("Result Matrix R%d:\n", k);
-            display(M, P, R[k]);
+            display(M, P, etype, (char *)R + k * sizeR * esize);
         }
     }
     */
 
+done:
     // Free memory
-    free(localA);
-    free(localB);
+    if (use_shm) {
+        node_shared_free(&winA);
+        node_shared_free(&winB);
+        node_info_free(&node);
+    } else {
+        free(localA);
+        free(localB);
+    }
     free(localR);
-    free(sendcountsA);
-    free(sendcountsB);
-    free(sendcountsR);
-    free(displsA);
-    free(displsB);
-    free(displsR);
+    free(sendcounts);
+    free(displs);
+    MPI_Type_free(&matA);
+    MPI_Type_free(&matB);
+    MPI_Type_free(&matR);
+    free(kcount);
 
     if (rank == 0) {
         free(A);
@@ -158,11 +436,21 @@ int main(int argc, char **argv) {
     }
 
     MPI_Finalize();
-    return 0;
+    return status;
 }
 
 
 /*
 mpicc mat_variable.c -o mat_var
 mpirun -np 4 ./mat_var 244 100 100 100
+mpirun -np 4 ./mat_var 244 100 100 100 --shm
+mpirun -np 4 ./mat_var 244 100 100 100 --type uint8
+mpirun -np 4 ./mat_var 244 100 100 100 --type uint8 --bench
+mpirun -np 4 ./mat_var 244 100 100 100 --calib-file mat_var.calib
+mpirun -np 4 ./mat_var 244 100 100 100 --shared-b
+mpirun -np 4 ./mat_var 244 100 100 100 --save-input batch.bin
+mpirun -np 4 ./mat_var --input batch.bin --output result.bin --calibrate
+mpirun -np 4 ./mat_var 244 100 100 100 --perf
+
+mpicc -O3 mat_variable.c -o mat_var   (vectorizes the int16 / uint8 kernels)
 */
@@ -0,0 +1,82 @@
+#ifndef MYERS_H
+#define MYERS_H
+
+#include <bits/stdc++.h>
+
+using namespace std;
+
+// Bit-parallel approximate substring matching (Myers 1999, in the blocked
+// form of Hyyro 2003 for patterns longer than 64 bytes). One column of the
+// edit distance DP between the pattern and a text is kept as vertical
+// +1/-1 bit vectors, 64 rows per word, so each text byte costs O(m / 64).
+struct MyersPattern {
+    int length = 0;
+    int blocks = 0;
+    bool fold = false;
+    vector<uint64_t> peq;     // peq[c * blocks + b]: rows of block b equal to byte c
+    vector<uint64_t> pv, mv;  // per-block column state, reused by every line
+};
+
+inline MyersPattern myers_compile(const string &pattern, bool fold) {
+    MyersPattern p;
+    p.length = pattern.size();
+    p.blocks = max(1, (p.length + 63) / 64);
+    p.fold = fold;
+    p.peq.assign(256 * p.blocks, 0);
+    for (int i = 0; i < p.length; i++) {
+        unsigned char c = pattern[i];
+        if (fold) c = tolower(c);
+        p.peq[c * p.blocks + i / 64] |= 1ULL << (i % 64);
+    }
+    p.pv.resize(p.blocks);
+    p.mv.resize(p.blocks);
+    return p;
+}
+
+// Smallest edit distance between the pattern and any substring of text
+inline int myers_distance(MyersPattern &p, const char *text, size_t len) {
+    int m = p.length;
+    if (m == 0) return 0;
+    int last = p.blocks - 1;
+    uint64_t last_bit = 1ULL << ((m - 1) % 64);
+    uint64_t high_bit = 1ULL << 63;
+
+    fill(p.pv.begin(), p.pv.end(), ~0ULL);
+    fill(p.mv.begin(), p.mv.end(), 0);
+    int score = m, best = m;
+
+    for (size_t j = 0; j < len && best > 0; j++) {
+        unsigned char c = text[j];
+        if (p.fold) c = tolower(c);
+        const uint64_t *eq_row = &p.peq[c * p.blocks];
+
+        // The top row of the search DP is all zeros, so block 0 gets no
+        // horizontal carry; each block hands its bottom delta to the next
+        int hin = 0;
+        for (int b = 0; b <= last; b++) {
+            uint64_t pv = p.pv[b], mv = p.mv[b], eq = eq_row[b];
+            uint64_t hin_neg = hin < 0 ? 1 : 0;
+            uint64_t xv = eq | mv;
+            eq |= hin_neg;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+
+            if (b == last) {
+                if (ph & last_bit) score++;
+                else if (mh & last_bit) score--;
+            }
+            int hout = (ph & high_bit) ? 1 : (mh & high_bit) ? -1 : 0;
+
+            ph = (ph << 1) | (hin > 0 ? 1 : 0);
+            mh = (mh << 1) | hin_neg;
+            p.pv[b] = mh | ~(xv | ph);
+            p.mv[b] = ph & xv;
+            hin = hout;
+        }
+        best = min(best, score);
+    }
+    return best;
+}
+
+#endif
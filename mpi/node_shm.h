@@ -0,0 +1,207 @@
+#ifndef NODE_SHM_H
+#define NODE_SHM_H
+
+#include <mpi.h>
+#include <stdlib.h>
+#include <string.h>
+#include "large_count.h"
+
+// Node-aware distribution (--shm). The ranks of a node share one copy of the
+// node's input in an MPI shared memory window: rank 0 sends each node's part
+// once, to the node leader (node rank 0), and every rank of the node works on
+// its own slice of the window in place.
+typedef struct {
+    MPI_Comm node_comm;    // ranks on this node
+    MPI_Comm leader_comm;  // node leaders only, MPI_COMM_NULL on other ranks
+    int node_rank, node_size;
+    int node_index, num_nodes;
+    int first_rank;        // world rank of this node's leader
+} NodeInfo;
+
+// Sets up the node and leader communicators. Returns 1 when the world ranks
+// of every node form one contiguous block (the default mapping), so that the
+// node slices stay in rank order; otherwise frees everything and returns 0
+// on every rank.
+static inline int node_info_init(NodeInfo *ni) {
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &ni->node_comm);
+    MPI_Comm_rank(ni->node_comm, &ni->node_rank);
+    MPI_Comm_size(ni->node_comm, &ni->node_size);
+    MPI_Comm_split(MPI_COMM_WORLD, ni->node_rank == 0 ? 0 : MPI_UNDEFINED, rank, &ni->leader_comm);
+
+    int info[3] = {0, 0, rank};
+    if (ni->node_rank == 0) {
+        MPI_Comm_rank(ni->leader_comm, &info[0]);
+        MPI_Comm_size(ni->leader_comm, &info[1]);
+    }
+    MPI_Bcast(info, 3, MPI_INT, 0, ni->node_comm);
+    ni->node_index = info[0];
+    ni->num_nodes = info[1];
+    ni->first_rank = info[2];
+
+    int contiguous = rank == ni->first_rank + ni->node_rank, all_contiguous;
+    MPI_Allreduce(&contiguous, &all_contiguous, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+    if (!all_contiguous) {
+        if (ni->leader_comm != MPI_COMM_NULL) MPI_Comm_free(&ni->leader_comm);
+        MPI_Comm_free(&ni->node_comm);
+    }
+    return all_contiguous;
+}
+
+static inline void node_info_free(NodeInfo *ni) {
+    if (ni->leader_comm != MPI_COMM_NULL) MPI_Comm_free(&ni->leader_comm);
+    MPI_Comm_free(&ni->node_comm);
+}
+
+// Allocates *bytes bytes of shared memory on the node leader (the value of
+// *bytes on other ranks is ignored) and returns the base address of the
+// leader's segment on every rank of the node, with *bytes set to its size.
+// The window stays in a passive epoch until node_shared_free.
+static inline void *node_shared_alloc(const NodeInfo *ni, MPI_Aint *bytes, MPI_Win *win) {
+    void *base;
+    int disp_unit;
+    MPI_Win_allocate_shared(ni->node_rank == 0 ? *bytes : 0, 1, MPI_INFO_NULL, ni->node_comm, &base, win);
+    MPI_Win_shared_query(*win, 0, bytes, &disp_unit, &base);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, *win);
+    return base;
+}
+
+// Makes the writes of every rank to the window visible to the whole node
+static inline void node_shared_sync(const NodeInfo *ni, MPI_Win win) {
+    MPI_Win_sync(win);
+    MPI_Barrier(ni->node_comm);
+    MPI_Win_sync(win);
+}
+
+static inline void node_shared_free(MPI_Win *win) {
+    MPI_Win_unlock_all(*win);
+    MPI_Win_free(win);
+}
+
+// MPI_Scatterv for --shm. counts and displs describe the usual rank-ordered
+// layout of sendbuf (significant on rank 0 only), in units of type, which may
+// be a derived type such as matrix_type; each node leader receives
+// the parts of all ranks of its node at once, into one shared window.
+// Returns the address of this rank's part inside the window.
+static inline void *node_scatterv(const NodeInfo *ni, const void *sendbuf, const int *counts,
+                                  const int *displs, MPI_Datatype type, MPI_Win *win) {
+    int rank;
+    MPI_Aint lb, extent;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Type_get_extent(type, &lb, &extent);
+
+    int node_count = 0, node_displ = displs[ni->first_rank];
+    for (int r = ni->first_rank; r < ni->first_rank + ni->node_size; r++) node_count += counts[r];
+
+    MPI_Aint bytes = (MPI_Aint)node_count * extent;
+    char *base = (char *)node_shared_alloc(ni, &bytes, win);
+    if (ni->node_rank == 0) {
+        int *node_counts = NULL, *node_displs = NULL;
+        if (rank == 0) {
+            node_counts = (int *)malloc(ni->num_nodes * sizeof(int));
+            node_displs = (int *)malloc(ni->num_nodes * sizeof(int));
+        }
+        MPI_Gather(&node_count, 1, MPI_INT, node_counts, 1, MPI_INT, 0, ni->leader_comm);
+        MPI_Gather(&node_displ, 1, MPI_INT, node_displs, 1, MPI_INT, 0, ni->leader_comm);
+        MPI_Scatterv(sendbuf, node_counts, node_displs, type, base, node_count, type, 0, ni->leader_comm);
+        free(node_counts);
+        free(node_displs);
+    }
+    node_shared_sync(ni, *win);
+    return base + (MPI_Aint)(displs[rank] - node_displ) * extent;
+}
+
+// MPI_Bcast for --shm: the node leaders receive count elements of type from
+// rank 0 into one shared window, which every rank of the node reads.
+static inline void *node_bcast(const NodeInfo *ni, const void *buf, int count, MPI_Datatype type, MPI_Win *win) {
+    int rank;
+    MPI_Aint lb, extent;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Type_get_extent(type, &lb, &extent);
+
+    MPI_Aint bytes = (MPI_Aint)count * extent;
+    char *base = (char *)node_shared_alloc(ni, &bytes, win);
+    if (ni->node_rank == 0) {
+        if (rank == 0) memcpy(base, buf, bytes);
+        MPI_Bcast(base, count, type, 0, ni->leader_comm);
+    }
+    node_shared_sync(ni, *win);
+    return base;
+}
+
+#ifdef __cplusplus
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Tag of the node portions sent by rank 0
+const int NODE_TAG = 3;
+
+// Distributes the phonebook for --shm. Rank 0 builds each node's text with
+// pack(first_line, last_line) from the same per-rank chunks as the regular
+// distribution and sends it to the node leader, which receives it straight
+// into a shared window. Returns this rank's slice of the node text, split by
+// bytes and aligned to whole lines.
+template <class Pack>
+std::string_view node_shard_text(const NodeInfo &ni, long long total_lines, Pack pack, MPI_Win *win) {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    std::string own_text;
+    long long len = 0;
+    if (ni.node_rank == 0) {
+        int node_ranks[2] = {ni.first_rank, ni.node_size};
+        std::vector<int> all_nodes(2 * ni.num_nodes);
+        MPI_Gather(node_ranks, 2, MPI_INT, all_nodes.data(), 2, MPI_INT, 0, ni.leader_comm);
+
+        if (rank == 0) {
+            long long chunk = (total_lines + size - 1) / size;
+            for (int j = 0; j < ni.num_nodes; j++) {
+                long long first = all_nodes[2 * j] * chunk;
+                long long last = first + all_nodes[2 * j + 1] * chunk;
+                std::string text = pack(first, last);
+                long long text_len = text.size();
+                if (j == 0) {
+                    own_text.swap(text);
+                } else {
+                    MPI_Send(&text_len, 1, MPI_LONG_LONG, all_nodes[2 * j], NODE_TAG, MPI_COMM_WORLD);
+                    send_bytes(text.data(), text_len, all_nodes[2 * j], NODE_TAG, MPI_COMM_WORLD);
+                }
+            }
+            len = own_text.size();
+        } else {
+            MPI_Recv(&len, 1, MPI_LONG_LONG, 0, NODE_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        }
+    }
+
+    MPI_Aint bytes = len;
+    char *text = (char *)node_shared_alloc(&ni, &bytes, win);
+    if (ni.node_rank == 0) {
+        if (rank == 0) {
+            own_text.copy(text, len);
+            std::string().swap(own_text);
+        } else {
+            recv_bytes(text, len, 0, NODE_TAG, MPI_COMM_WORLD);
+        }
+    }
+    node_shared_sync(&ni, *win);
+
+    // Slice boundaries move forward to the start of the next line
+    std::string_view node_text(text, bytes);
+    auto boundary = [&](int r) -> size_t {
+        size_t pos = (size_t)((long long)bytes * r / ni.node_size);
+        if (pos == 0 || pos >= node_text.size()) return std::min(pos, node_text.size());
+        size_t nl = node_text.find('\n', pos - 1);
+        return nl == std::string_view::npos ? node_text.size() : nl + 1;
+    };
+    size_t lo = boundary(ni.node_rank), hi = boundary(ni.node_rank + 1);
+    return node_text.substr(lo, hi - lo);
+}
+
+#endif
+
+#endif
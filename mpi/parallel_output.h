@@ -0,0 +1,46 @@
+#ifndef PARALLEL_OUTPUT_H
+#define PARALLEL_OUTPUT_H
+
+#include <bits/stdc++.h>
+#include <mpi.h>
+#include "large_count.h"
+
+using namespace std;
+
+// Writes the text of every rank of comm to path, concatenated in rank order,
+// with collective MPI_File_write_at_all calls of at most MPI_CHUNK_BYTES per
+// rank (one call unless a text is larger). Each rank finds its file offset
+// with MPI_Exscan over the text lengths, so no data passes through the root.
+// Returns false on every rank, with a message from rank 0, if the file could
+// not be opened or written.
+inline bool write_ordered(const string &path, const string &text, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    long long len = text.size(), offset = 0, total = 0, longest = 0;
+    MPI_Exscan(&len, &offset, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    if (rank == 0) offset = 0;  // MPI_Exscan leaves rank 0's result undefined
+    MPI_Allreduce(&len, &total, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    MPI_Allreduce(&len, &longest, 1, MPI_LONG_LONG, MPI_MAX, comm);
+
+    MPI_File fh;
+    if (MPI_File_open(comm, path.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                      MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        if (rank == 0) cerr << "Could not open file: " << path << endl;
+        return false;
+    }
+    // Drop whatever is left of a longer, older output file
+    int ok = MPI_File_set_size(fh, total) == MPI_SUCCESS;
+    // Every rank joins every round, with an empty write once its text is done
+    for (long long done = 0; done < longest; done += MPI_CHUNK_BYTES) {
+        long long n = max(0LL, min(len - done, (long long)MPI_CHUNK_BYTES));
+        ok &= MPI_File_write_at_all(fh, offset + min(done, len), text.data() + min(done, len), n, MPI_CHAR,
+                                    MPI_STATUS_IGNORE) == MPI_SUCCESS;
+    }
+    ok &= MPI_File_close(&fh) == MPI_SUCCESS;
+    MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_LAND, comm);
+    if (!ok && rank == 0) cerr << "Could not write file: " << path << endl;
+    return ok;
+}
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <mpi.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+// --perf: hardware counters around a compute loop, read with Linux
+// perf_event_open for the calling thread in user space. Every event is opened
+// on its own, so one the machine lacks (no PMU in a VM, perf_event_paranoid,
+// not Linux) only blanks its column. Counts are scaled up when the kernel
+// multiplexes the events.
+enum { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_LLC_MISSES, PERF_BRANCH_MISSES, PERF_EVENTS };
+
+typedef struct {
+    int fd[PERF_EVENTS];
+    int error;  // errno of the first event that could not be opened
+} PerfCounters;
+
+// Opens and starts the counters
+static inline void perf_start(PerfCounters *pc) {
+    pc->error = 0;
+#ifdef __linux__
+    // PERF_COUNT_HW_CACHE_MISSES counts last level cache misses on x86
+    static const unsigned long long config[PERF_EVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config[e];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        pc->fd[e] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (pc->fd[e] < 0 && !pc->error) pc->error = errno;
+    }
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        if (pc->fd[e] >= 0) ioctl(pc->fd[e], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#else
+    for (int e = 0; e < PERF_EVENTS; e++) pc->fd[e] = -1;
+    pc->error = ENOSYS;
+#endif
+}
+
+// Stops and closes the counters; counts[e] is -1 for an event that could not
+// be counted
+static inline void perf_stop(PerfCounters *pc, long long counts[PERF_EVENTS]) {
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        counts[e] = -1;
+#ifdef __linux__
+        if (pc->fd[e] < 0) continue;
+        ioctl(pc->fd[e], PERF_EVENT_IOC_DISABLE, 0);
+        unsigned long long v[3];  // value, time enabled, time running
+        if (read(pc->fd[e], v, sizeof(v)) == (ssize_t)sizeof(v) && v[2] > 0) {
+            counts[e] = (long long)((double)v[0] * v[1] / v[2]);
+        }
+        close(pc->fd[e]);
+        pc->fd[e] = -1;
+#endif
+    }
+}
+
+static inline void print_count(double v) {
+    if (v < 0) printf(" %14s", "n/a");
+    else printf(" %14.0f", v);
+}
+
+static inline void print_ratio(double num, double den, const char *format) {
+    if (num < 0 || den <= 0) printf(" %10s", "n/a");
+    else printf(format, num / den);
+}
+
+// Collects the counts of every rank on the root, with the work each rank did
+// in the loop (lines scanned, multiply-adds, ...), and prints one row per rank
+// and a total: raw counts, IPC, and misses per unit of work.
+static inline void report_perf(const char *loop, const PerfCounters *pc, const long long counts[PERF_EVENTS],
+                               double work, const char *unit, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // Per rank: the counts, the work and the first open error
+    enum { ROW = PERF_EVENTS + 2 };
+    double row[ROW];
+    for (int e = 0; e < PERF_EVENTS; e++) row[e] = (double)counts[e];
+    row[PERF_EVENTS] = work;
+    row[PERF_EVENTS + 1] = pc->error;
+
+    double *rows = NULL;
+    if (rank == 0) rows = (double *)malloc((size_t)(size + 1) * ROW * sizeof(double));
+    MPI_Gather(row, ROW, MPI_DOUBLE, rows, ROW, MPI_DOUBLE, 0, comm);
+    if (rank != 0) return;
+
+    // The total row only sums events every rank could count
+    double *total = rows + (size_t)size * ROW;
+    int any = 0, error = 0;
+    for (int c = 0; c < ROW; c++) total[c] = 0;
+    for (int r = 0; r < size; r++) {
+        for (int c = 0; c < ROW; c++) {
+            double v = rows[r * ROW + c];
+            if (c < PERF_EVENTS && v >= 0) any = 1;
+            if (c == PERF_EVENTS + 1) {
+                if (!error) error = (int)v;
+            } else if (total[c] >= 0) {
+                total[c] = v < 0 ? -1 : total[c] + v;
+            }
+        }
+    }
+
+    if (!any) {
+        printf("Hardware counters unavailable (perf_event_open: %s; see /proc/sys/kernel/perf_event_paranoid)\n",
+               error ? strerror(error) : "no events counted");
+    } else {
+        printf("Hardware counters, %s (per %s):\n", loop, unit);
+        printf("%5s %14s %14s %14s %14s %10s %10s %10s\n", "rank", "cycles", "instructions", "LLC-misses",
+               "branch-miss", "IPC", "LLC/unit", "br/unit");
+        for (int r = 0; r <= size; r++) {
+            const double *v = rows + (size_t)r * ROW;
+            if (r < size) printf("%5d", r);
+            else printf("%5s", "all");
+            for (int e = 0; e < PERF_EVENTS; e++) print_count(v[e]);
+            print_ratio(v[PERF_INSTRUCTIONS], v[PERF_CYCLES], " %10.2f");
+            print_ratio(v[PERF_LLC_MISSES], v[PERF_EVENTS], " %10.4g");
+            print_ratio(v[PERF_BRANCH_MISSES], v[PERF_EVENTS], " %10.4g");
+            printf("\n");
+        }
+        if (error) printf("Some counters unavailable: %s\n", strerror(error));
+    }
+    fflush(stdout);
+    free(rows);
+}
+
+#endif
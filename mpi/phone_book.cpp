@@ -1,31 +1,37 @@
 #include <bits/stdc++.h>
 #include <mpi.h>
+#include "search_modes.h"
+#include "sample_sort.h"
+#include "string_sort.h"
+#include "parallel_output.h"
+#include "myers.h"
+#include "node_shm.h"
+#include "large_count.h"
+#include "perf_counters.h"
+#include "regex_dfa.h"
 
 using namespace std;
 
 // Function to send a large string over MPI
 void send_string(const string &text, int receiver) {
-    int len = text.size() + 1;
-    MPI_Send(&len, 1, MPI_INT, receiver, 1, MPI_COMM_WORLD);
-    MPI_Send(text.c_str(), len, MPI_CHAR, receiver, 1, MPI_COMM_WORLD);
+    long long len = text.size();
+    MPI_Send(&len, 1, MPI_LONG_LONG, receiver, 1, MPI_COMM_WORLD);
+    send_bytes(text.data(), len, receiver, 1, MPI_COMM_WORLD);
 }
 
 // Function to receive a large string over MPI
 string receive_string(int sender) {
-    int len;
-    MPI_Status status;
-    MPI_Recv(&len, 1, MPI_INT, sender, 1, MPI_COMM_WORLD, &status);
-    char *buf = new char[len];
-    MPI_Recv(buf, len, MPI_CHAR, sender, 1, MPI_COMM_WORLD, &status);
-    string res(buf);
-    delete[] buf;
+    long long len;
+    MPI_Recv(&len, 1, MPI_LONG_LONG, sender, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    string res(len, '\0');
+    recv_bytes(&res[0], len, sender, 1, MPI_COMM_WORLD);
     return res;
 }
 
 // Converts a range of a vector of strings into one single string for transmission
-string vector_to_string(const vector<string> &lines, int start, int end) {
+string vector_to_string(const vector<string> &lines, long long start, long long end) {
     string result;
-    for (int i = start; i < min((int)lines.size(), end); i++) {
+    for (long long i = start; i < min((long long)lines.size(), end); i++) {
         result += lines[i] + "\n";
     }
     return result;
@@ -42,6 +48,19 @@ vector<string> string_to_vector(const string &text) {
     return lines;
 }
 
+// Splits received text into lines in place, without copying them (--shm)
+vector<string_view> string_to_views(string_view text) {
+    vector<string_view> lines;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == string_view::npos) end = text.size();
+        if (end > start) lines.push_back(text.substr(start, end - start));
+        start = end + 1;
+    }
+    return lines;
+}
+
 // Reads raw lines from multiple files into a vector
 void read_phonebook(const vector<string> &files, vector<string> &lines) {
     for (const string &file : files) {
@@ -57,106 +76,440 @@ void read_phonebook(const vector<string> &files, vector<string> &lines) {
     }
 }
 
+// Sorts lines in byte order with the string radix sort
+void sort_lines(vector<string> &lines) {
+    sort_by_text(lines, [](const string &s) -> const string & { return s; }, false);
+}
+
+// Packed phone number key: the digits of the phone field, left-aligned to
+// PHONE_KEY_DIGITS decimal places so that every digit prefix maps to one
+// contiguous key range. Spaces and dashes are not part of the key.
+const int PHONE_KEY_DIGITS = 19;
+
+struct PhoneKey {
+    uint64_t key;
+    int digits;
+};
+
+bool operator<(const PhoneKey &a, const PhoneKey &b) {
+    return a.key != b.key ? a.key < b.key : a.digits < b.digits;
+}
+
+uint64_t pow10_u64(int e) {
+    uint64_t p = 1;
+    while (e-- > 0) p *= 10;
+    return p;
+}
+
+// Packs a phone number such as "017 62 031" or "017-62-031"; any character
+// other than a digit, space or dash makes it unpackable
+bool pack_phone(const string &phone, PhoneKey &out) {
+    uint64_t key = 0;
+    int digits = 0;
+    for (char c : phone) {
+        if (c == ' ' || c == '-') continue;
+        if (c < '0' || c > '9' || digits == PHONE_KEY_DIGITS) return false;
+        key = key * 10 + (c - '0');
+        digits++;
+    }
+    out.key = key * pow10_u64(PHONE_KEY_DIGITS - digits);
+    out.digits = digits;
+    return true;
+}
+
+// Returns the phone field of a line: the last quoted field, or the text after
+// the last comma when the line is not quoted
+string phone_field(const string &line) {
+    size_t end = line.rfind('"');
+    if (end != string::npos && end > 0) {
+        size_t begin = line.rfind('"', end - 1);
+        if (begin != string::npos) return line.substr(begin + 1, end - begin - 1);
+    }
+    size_t comma = line.rfind(',');
+    return comma == string::npos ? line : line.substr(comma + 1);
+}
+
+// Builds the phone index in place: lines keeps the lines with a packable
+// phone field, sorted by key, and keys their packed keys. Only an index is
+// sorted; the strings are moved once, not copied.
+void build_phone_index(vector<string> &lines, vector<PhoneKey> &keys) {
+    vector<pair<PhoneKey, size_t>> order;
+    for (size_t i = 0; i < lines.size(); i++) {
+        PhoneKey k;
+        if (pack_phone(phone_field(lines[i]), k)) order.push_back({k, i});
+    }
+    sort(order.begin(), order.end());
+    keys.clear();
+    keys.reserve(order.size());
+    vector<string> sorted_lines;
+    sorted_lines.reserve(order.size());
+    for (const auto &o : order) {
+        keys.push_back(o.first);
+        sorted_lines.push_back(move(lines[o.second]));
+    }
+    lines.swap(sorted_lines);
+}
+
+// Sends the packed keys of a shard, as raw bytes, after its text
+void send_keys(const PhoneKey *keys, long long n, int receiver) {
+    MPI_Send(&n, 1, MPI_LONG_LONG, receiver, 1, MPI_COMM_WORLD);
+    send_bytes((const char *)keys, n * (long long)sizeof(PhoneKey), receiver, 1, MPI_COMM_WORLD);
+}
+
+vector<PhoneKey> receive_keys(int sender) {
+    long long n;
+    MPI_Recv(&n, 1, MPI_LONG_LONG, sender, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    vector<PhoneKey> keys(n);
+    recv_bytes((char *)keys.data(), n * (long long)sizeof(PhoneKey), sender, 1, MPI_COMM_WORLD);
+    return keys;
+}
+
+// Returns [first, last) of the keys starting with the digits of prefix.
+// Shorter numbers that are themselves a prefix of the query share the lower
+// key, but sort before it because of their smaller digit count.
+pair<long long, long long> phone_prefix_range(const vector<PhoneKey> &keys, const PhoneKey &prefix) {
+    PhoneKey lo = prefix;
+    PhoneKey hi = {0, 0};
+    auto first = lower_bound(keys.begin(), keys.end(), lo);
+    auto last = keys.end();
+    if (prefix.digits > 0) {
+        hi.key = prefix.key + pow10_u64(PHONE_KEY_DIGITS - prefix.digits);
+        // The range ends at the top of the key space for an all-nines prefix
+        if (hi.key > prefix.key) last = lower_bound(first, keys.end(), hi);
+    }
+    return {first - keys.begin(), last - keys.begin()};
+}
+
+// Phone prefix search: rank 0 sorts the whole phonebook by packed key and
+// hands every rank one contiguous key range, with its packed keys, so each
+// rank answers its part of the prefix range with two binary searches.
+// --count and --exists only need the range sizes; --top keeps the first K
+// lines of each range.
+void phone_prefix_search(const vector<string> &files, const string &search_term, int rank, int size,
+                         const SearchOptions &opts) {
+    PhoneKey prefix;
+    if (!pack_phone(search_term, prefix)) {
+        if (rank == 0) cerr << "Invalid phone prefix: " << search_term << "\n";
+        return;
+    }
+
+    vector<string> local_lines;
+    vector<PhoneKey> local_keys;
+    double start_time = 0, end_time;
+    if (rank == 0) {
+        read_phonebook(files, local_lines);
+        build_phone_index(local_lines, local_keys);
+
+        long long total = local_lines.size();
+        long long chunk = (total + size - 1) / size;
+
+        // Distribute key-range shards, with their keys, to workers
+        for (int i = 1; i < size; i++) {
+            long long first = min(i * chunk, total), last = min((i + 1) * chunk, total);
+            send_string(vector_to_string(local_lines, first, last), i);
+            send_keys(local_keys.data() + first, last - first, i);
+        }
+        local_lines.resize(min(chunk, total));
+        local_keys.resize(min(chunk, total));
+
+        start_time = MPI_Wtime();
+    } else {
+        local_lines = string_to_vector(receive_string(0));
+        local_keys = receive_keys(0);
+    }
+
+    // Shards arrive in key order, so the query is two binary searches
+    PerfCounters perf = {{0}, 0};
+    long long counts[PERF_EVENTS];
+    if (opts.perf) perf_start(&perf);
+    double local_start = MPI_Wtime();
+    pair<long long, long long> range = phone_prefix_range(local_keys, prefix);
+    double local_end = MPI_Wtime();
+    if (opts.perf) perf_stop(&perf, counts);
+    printf("Process %d in time %f seconds.\n", rank, local_end - local_start);
+    if (opts.perf) report_perf("phone prefix lookup", &perf, counts, 1, "query", MPI_COMM_WORLD);
+
+    if (opts.mode == RESULT_COUNT || opts.mode == RESULT_EXISTS) {
+        long long local_count = range.second - range.first, total_count = 0;
+        MPI_Reduce(&local_count, &total_count, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (rank == 0) {
+            end_time = MPI_Wtime();
+            if (opts.mode == RESULT_COUNT) {
+                write_summary(to_string(total_count));
+                cout << "Search complete. Found " << total_count << " matches." << endl;
+            } else {
+                write_summary(total_count > 0 ? "yes" : "no");
+                cout << "Search complete. " << (total_count > 0 ? "Match found." : "No match found.") << endl;
+            }
+            printf("Total execution time : %f seconds.\n", end_time - start_time);
+        }
+        return;
+    }
+
+    vector<string> matches;
+    for (long long i = range.first; i < range.second; i++) {
+        if (opts.mode == RESULT_TOP_K) keep_top_k(matches, local_lines[i], opts.top_k, less<string>());
+        else matches.push_back(move(local_lines[i]));
+    }
+
+    if (rank != 0) {
+        send_string(vector_to_string(matches, 0, matches.size()), 0);
+        return;
+    }
+
+    vector<string> final_matches = move(matches);
+    for (int i = 1; i < size; i++) {
+        vector<string> worker_vec = string_to_vector(receive_string(i));
+        final_matches.insert(final_matches.end(), worker_vec.begin(), worker_vec.end());
+    }
+    sort_lines(final_matches);
+    if (opts.mode == RESULT_TOP_K && (long long)final_matches.size() > opts.top_k) {
+        final_matches.resize(opts.top_k);
+    }
+    end_time = MPI_Wtime();
+
+    ofstream out("output.txt");
+    for (const string &match : final_matches) {
+        out << match << "\n";
+    }
+    out.close();
+
+    cout << "Search complete. Found " << final_matches.size() << " matches." << endl;
+    printf("Total execution time : %f seconds.\n", end_time - start_time);
+}
+
 int main(int argc, char **argv) {
     MPI_Init(&argc, &argv);
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    if (argc < 3) {
+    SearchOptions opts;
+    int first_arg = parse_search_options(argc, argv, opts, rank);
+
+    if (first_arg < 0 || argc - first_arg < 2) {
         if (rank == 0)
-            cerr << "Usage: mpirun -n <procs> " << argv[0] << " <file1>... <search_term>\n";
+            cerr << "Usage: mpirun -n <procs> " << argv[0]
+                 << " [--phone] [--count | --exists | --top <K> | --sample-sort | --mpi-io]"
+                 << " [--max-errors <K> | --regex] [--shm] <file1>... <search_term>\n";
         MPI_Finalize();
         return 1;
     }
 
     string search_term = argv[argc - 1];
-    double start_time, end_time;
+    vector<string> files(argv + first_arg, argv + argc - 1);
+
+    if (opts.phone_prefix) {
+        // --phone treats the search term as a phone number prefix
+        phone_prefix_search(files, search_term, rank, size, opts);
+        MPI_Finalize();
+        return 0;
+    }
+
+    // Rank 0 compiles a --regex pattern once and broadcasts the DFA
+    RegexDfa dfa;
+    if (opts.regex && !regex_bcast(search_term, false, dfa, 0, MPI_COMM_WORLD)) {
+        MPI_Finalize();
+        return 1;
+    }
+
+    double start_time = 0, end_time;
+
+    NodeInfo node;
+    MPI_Win shard_win = MPI_WIN_NULL;
+    if (opts.shm && !node_info_init(&node)) {
+        if (rank == 0) cerr << "--shm needs the ranks of each node numbered contiguously; using per-rank chunks\n";
+        opts.shm = false;
+    }
+
+    vector<string> all_lines, local_lines;
+    vector<string_view> local_view;  // the lines this rank searches
 
     if (rank == 0) {
         // --- MASTER PROCESS ---
-        vector<string> files;
-        for (int i = 1; i < argc - 1; i++) files.push_back(argv[i]);
-
-        vector<string> all_lines;
         read_phonebook(files, all_lines);
 
-        int total = all_lines.size();
-        int chunk = (total + size - 1) / size;
+        long long total = all_lines.size();
+        long long chunk = (total + size - 1) / size;
 
         // Distribute data to workers
-        for (int i = 1; i < size; i++) {
+        for (int i = 1; i < size && !opts.shm; i++) {
             string text_chunk = vector_to_string(all_lines, i * chunk, (i + 1) * chunk);
             send_string(text_chunk, i);
         }
 
-        // Start global timer
-        start_time = MPI_Wtime();
+        // The master keeps the first chunk for itself
+        if (!opts.shm) {
+            all_lines.resize(min(chunk, total));
+            local_lines.swap(all_lines);
+        }
+    } else if (!opts.shm) {
+        // --- WORKER PROCESS ---
+        string recv_text = receive_string(0);
+        local_lines = string_to_vector(recv_text);
+    }
+
+    if (opts.shm) {
+        // Each node receives its part once and searches it in shared memory
+        string_view node_text = node_shard_text(node, all_lines.size(), [&](long long first, long long last) {
+            return vector_to_string(all_lines, first, last);
+        }, &shard_win);
+        vector<string>().swap(all_lines);
+        local_view = string_to_views(node_text);
+    } else {
+        local_view.assign(local_lines.begin(), local_lines.end());
+    }
+
+    // Start global timer
+    if (rank == 0) start_time = MPI_Wtime();
+
+    // Distance of a line to the search term: 0 for an exact (or --regex)
+    // match, the edit distance (at most --max-errors) in fuzzy mode, -1 when
+    // it does not match
+    MyersPattern fuzzy_pattern = myers_compile(search_term, false);
+    auto match_distance = [&](string_view text) {
+        if (opts.regex) return regex_search(dfa, text) ? 0 : -1;
+        if (opts.max_errors < 0) return text.find(search_term) != string::npos ? 0 : -1;
+        int d = myers_distance(fuzzy_pattern, text.data(), text.size());
+        return d <= opts.max_errors ? d : -1;
+    };
 
-        // --- MASTER CHUNK SEARCH ---
-        double master_start = MPI_Wtime();
-        vector<string> final_matches;
-        for (int i = 0; i < min(chunk, total); i++) {
-            if (all_lines[i].find(search_term) != string::npos) {
-                final_matches.push_back(all_lines[i]);
+    // --- LOCAL CHUNK SEARCH ---
+    // Matches are grouped by distance; an exact search has only distance 0,
+    // and no distance exceeds the term length (delete every term byte)
+    PerfCounters perf = {{0}, 0};
+    long long counts[PERF_EVENTS];
+    if (opts.perf) perf_start(&perf);
+    double local_start = MPI_Wtime();
+    vector<vector<string>> local_matches(min(max(opts.max_errors, 0), (int)search_term.size()) + 1);
+    long long local_count = 0;
+    bool found = false;
+    if (opts.mode == RESULT_EXISTS) {
+        found = exists_scan(local_view.size(), [&](size_t i) {
+            return match_distance(local_view[i]) >= 0;
+        }, MPI_COMM_WORLD);
+    } else {
+        for (string_view line : local_view) {
+            int d = match_distance(line);
+            if (d < 0) continue;
+            local_count++;
+            if (opts.mode == RESULT_ALL) {
+                local_matches[d].emplace_back(line);
+            } else if (opts.mode == RESULT_TOP_K) {
+                keep_top_k(local_matches[0], string(line), opts.top_k, less<string>());
             }
         }
-        double master_end = MPI_Wtime();
-        // printf("Master process searched %d lines in %f seconds.\n",
-        //        min(chunk, total), master_end - master_start);
-        // print time to process master chunk
-        printf("Process %d in time %f seconds.\n", rank, master_end - master_start);
+    }
+    double local_end = MPI_Wtime();
+    if (opts.perf) perf_stop(&perf, counts);
+    printf("Process %d in time %f seconds.\n", rank, local_end - local_start);
+    if (opts.perf) report_perf("search loop", &perf, counts, local_view.size(), "line", MPI_COMM_WORLD);
 
-        // Receive results from workers
-        for (int i = 1; i < size; i++) {
-            string worker_raw_res = receive_string(i);
-            vector<string> worker_vec = string_to_vector(worker_raw_res);
-            final_matches.insert(final_matches.end(), worker_vec.begin(), worker_vec.end());
+    int status = 0;  // 1 if output.txt could not be written
+    if (opts.mode == RESULT_COUNT) {
+        long long total_count = 0;
+        MPI_Reduce(&local_count, &total_count, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (rank == 0) {
+            end_time = MPI_Wtime();
+            write_summary(to_string(total_count));
+            cout << "Search complete. Found " << total_count << " matches." << endl;
+            printf("Total execution time : %f seconds.\n", end_time - start_time);
+        }
+    } else if (opts.mode == RESULT_EXISTS) {
+        if (rank == 0) {
+            end_time = MPI_Wtime();
+            write_summary(found ? "yes" : "no");
+            cout << "Search complete. " << (found ? "Match found." : "No match found.") << endl;
+            printf("Total execution time : %f seconds.\n", end_time - start_time);
+        }
+    } else {
+        // With --sample-sort every rank ends up holding one sorted range of the
+        // result, so the root only has to concatenate the ranges in rank order
+        if (opts.sample_sort) {
+            sample_sort(local_matches[0], less<string>(), sort_lines, vector_to_string, string_to_vector, MPI_COMM_WORLD);
         }
 
-        // Sort results
-        sort(final_matches.begin(), final_matches.end());
+        if (opts.mpi_io) {
+            // Every rank writes its own range of output.txt
+            string out_text;
+            for (const string &match : local_matches[0]) {
+                out_text += match + "\n";
+            }
+            if (!write_ordered("output.txt", out_text, MPI_COMM_WORLD)) status = 1;
 
-        end_time = MPI_Wtime();
+            long long local_found = local_matches[0].size(), total_found = 0;
+            MPI_Reduce(&local_found, &total_found, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+            if (rank == 0 && !status) {
+                end_time = MPI_Wtime();
+                cout << "Search complete. Found " << total_found << " matches." << endl;
+                printf("Total execution time : %f seconds.\n", end_time - start_time);
+            }
+        } else if (rank != 0) {
+            // Send local results (all matches, or the local top K) back to
+            // Master, one message per distance
+            for (const vector<string> &matches : local_matches) {
+                send_string(vector_to_string(matches, 0, matches.size()), 0);
+            }
+        } else {
+            // Receive results from workers; fuzzy results are ranked by
+            // distance first, then in the usual order
+            vector<string> final_matches;
+            for (vector<string> &matches : local_matches) {
+                for (int i = 1; i < size; i++) {
+                    string worker_raw_res = receive_string(i);
+                    vector<string> worker_vec = string_to_vector(worker_raw_res);
+                    matches.insert(matches.end(), worker_vec.begin(), worker_vec.end());
+                }
 
-        // Write results
-        ofstream out("output.txt");
-        for (const string &match : final_matches) {
-            out << match << "\n";
-        }
-        out.close();
+                if (opts.sample_sort) {
+                    // The ranges arrive already in global order
+                } else {
+                    // Sort results
+                    sort_lines(matches);
+                }
+                final_matches.insert(final_matches.end(), matches.begin(), matches.end());
+            }
+            // In top-K mode only K candidates per rank arrive here
+            if (opts.mode == RESULT_TOP_K && (int)final_matches.size() > opts.top_k) {
+                final_matches.resize(opts.top_k);
+            }
 
-        cout << "Search complete. Found " << final_matches.size() << " matches." << endl;
-        printf("Total execution time : %f seconds.\n",
-               end_time - start_time);
+            end_time = MPI_Wtime();
 
-    } else {
-        // --- WORKER PROCESS ---
-        string recv_text = receive_string(0);
-        vector<string> local_lines = string_to_vector(recv_text);
-        
-        double worker_start = MPI_Wtime();
-        string local_matches_str = "";
-        for (const string &line : local_lines) {
-            if (line.find(search_term) != string::npos) {
-                local_matches_str += line + "\n";
+            // Write results
+            ofstream out("output.txt");
+            for (const string &match : final_matches) {
+                out << match << "\n";
             }
+            out.close();
+
+            cout << "Search complete. Found " << final_matches.size() << " matches." << endl;
+            printf("Total execution time : %f seconds.\n",
+                   end_time - start_time);
         }
-        double worker_end = MPI_Wtime();
+    }
 
-        // Send local results back to Master
-        send_string(local_matches_str, 0);
-        // printf("Process %d processed %lu lines in %f seconds.\n",
-        //        rank, local_lines.size(), worker_end - worker_start);
-        printf("Process %d in time %f seconds.\n", rank, worker_end - worker_start);
+    if (opts.shm) {
+        node_shared_free(&shard_win);
+        node_info_free(&node);
     }
 
     MPI_Finalize();
-    return 0;
+    return status;
 }
 
 
 /*
 mpic++ phone_book.cpp -o phone_book
 mpirun -n 4 ./phone_book input.txt 'TUMPA'
+mpirun -n 4 ./phone_book --phone input.txt '015 10'
+mpirun -n 4 ./phone_book --phone --count input.txt '017'
+mpirun -n 4 ./phone_book --top 50 input.txt 'MD'
+mpirun -n 4 ./phone_book --sample-sort input.txt '01'
+mpirun -n 4 ./phone_book --mpi-io input.txt '01'
+mpirun -n 4 ./phone_book --max-errors 1 input.txt 'HASEN'
+mpirun -n 4 ./phone_book --regex input.txt '^"MD.*HASAN"'
+mpirun -n 4 ./phone_book --perf input.txt 'TUMPA'
+
+mpic++ -DMPI_CHUNK_BYTES=4096 phone_book.cpp -o phone_book   (tiny chunks, to exercise the large-count paths)
 */
\ No newline at end of file
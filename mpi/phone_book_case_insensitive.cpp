@@ -1,37 +1,43 @@
 #include <bits/stdc++.h>
 #include <mpi.h>
+#include "search_modes.h"
+#include "sample_sort.h"
+#include "string_sort.h"
+#include "parallel_output.h"
+#include "myers.h"
+#include "node_shm.h"
+#include "large_count.h"
+#include "perf_counters.h"
+#include "regex_dfa.h"
 
 using namespace std;
 
 // Structure to hold a line and its line number
 struct Entry {
-    int line_number;
+    long long line_number;
     string text;
 };
 
 // Function to send a large string over MPI
 void send_string(const string &text, int receiver) {
-    int len = text.size() + 1;
-    MPI_Send(&len, 1, MPI_INT, receiver, 1, MPI_COMM_WORLD);
-    MPI_Send(text.c_str(), len, MPI_CHAR, receiver, 1, MPI_COMM_WORLD);
+    long long len = text.size();
+    MPI_Send(&len, 1, MPI_LONG_LONG, receiver, 1, MPI_COMM_WORLD);
+    send_bytes(text.data(), len, receiver, 1, MPI_COMM_WORLD);
 }
 
 // Function to receive a large string over MPI
 string receive_string(int sender) {
-    int len;
-    MPI_Status status;
-    MPI_Recv(&len, 1, MPI_INT, sender, 1, MPI_COMM_WORLD, &status);
-    char *buf = new char[len];
-    MPI_Recv(buf, len, MPI_CHAR, sender, 1, MPI_COMM_WORLD, &status);
-    string res(buf);
-    delete[] buf;
+    long long len;
+    MPI_Recv(&len, 1, MPI_LONG_LONG, sender, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    string res(len, '\0');
+    recv_bytes(&res[0], len, sender, 1, MPI_COMM_WORLD);
     return res;
 }
 
 // Converts a range of entries into one single string for transmission
-string entries_to_string(const vector<Entry> &entries, int start, int end) {
+string entries_to_string(const vector<Entry> &entries, long long start, long long end) {
     string result;
-    for (int i = start; i < min((int)entries.size(), end); i++) {
+    for (long long i = start; i < min((long long)entries.size(), end); i++) {
         result += to_string(entries[i].line_number) + "|" + entries[i].text + "\n";
     }
     return result;
@@ -46,7 +52,7 @@ vector<Entry> string_to_entries(const string &text) {
         if (!line.empty()) {
             size_t pos = line.find('|');
             if (pos != string::npos) {
-                int line_number = stoi(line.substr(0, pos));
+                long long line_number = stoll(line.substr(0, pos));
                 string content = line.substr(pos + 1);
                 entries.push_back({line_number, content});
             }
@@ -55,9 +61,33 @@ vector<Entry> string_to_entries(const string &text) {
     return entries;
 }
 
+// A line searched in place, in this rank's entries or in the node's shared
+// window (--shm)
+struct EntryView {
+    long long line_number;
+    string_view text;
+};
+
+// Parses entries in place, without copying their text
+vector<EntryView> string_to_entry_views(string_view text) {
+    vector<EntryView> entries;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == string_view::npos) end = text.size();
+        string_view line = text.substr(start, end - start);
+        size_t pos = line.find('|');
+        if (pos != string_view::npos) {
+            entries.push_back({atoll(line.data()), line.substr(pos + 1)});
+        }
+        start = end + 1;
+    }
+    return entries;
+}
+
 // Reads raw lines from multiple files into entries with line numbers
 void read_phonebook(const vector<string> &files, vector<Entry> &entries) {
-    int line_number = 1;
+    long long line_number = 1;
     for (const string &file : files) {
         ifstream f(file);
         if (!f.is_open()) {
@@ -75,21 +105,36 @@ void read_phonebook(const vector<string> &files, vector<Entry> &entries) {
 }
 
 // Helper: lowercase a string
-string to_lower(const string &s) {
-    string res = s;
+string to_lower(string_view s) {
+    string res(s);
     transform(res.begin(), res.end(), res.begin(), ::tolower);
     return res;
 }
 
+// Sorts entries case-insensitively by text, equal texts by line number
+void sort_entries(vector<Entry> &entries) {
+    sort_by_text(entries, [](const Entry &e) -> const string & { return e.text; }, true,
+                 [](const Entry &e) { return e.line_number; });
+}
+
 int main(int argc, char **argv) {
     MPI_Init(&argc, &argv);
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    if (argc < 3) {
+    SearchOptions opts;
+    int first_arg = parse_search_options(argc, argv, opts, rank);
+    if (opts.phone_prefix) {
+        if (rank == 0) cerr << "--phone is only supported by phone_book\n";
+        first_arg = -1;
+    }
+
+    if (first_arg < 0 || argc - first_arg < 2) {
         if (rank == 0)
-            cerr << "Usage: mpirun -n <procs> " << argv[0] << " <file1>... <search_term>\n";
+            cerr << "Usage: mpirun -n <procs> " << argv[0]
+                 << " [--count | --exists | --top <K> | --sample-sort | --mpi-io]"
+                 << " [--max-errors <K> | --regex] [--shm] <file1>... <search_term>\n";
         MPI_Finalize();
         return 1;
     }
@@ -97,88 +142,210 @@ int main(int argc, char **argv) {
     string search_term = argv[argc - 1];
     string lower_term = to_lower(search_term);
 
-    double start_time, end_time;
+    // Rank 0 compiles a --regex pattern once and broadcasts the DFA
+    RegexDfa dfa;
+    if (opts.regex && !regex_bcast(search_term, true, dfa, 0, MPI_COMM_WORLD)) {
+        MPI_Finalize();
+        return 1;
+    }
+
+    double start_time = 0, end_time;
+
+    NodeInfo node;
+    MPI_Win shard_win = MPI_WIN_NULL;
+    if (opts.shm && !node_info_init(&node)) {
+        if (rank == 0) cerr << "--shm needs the ranks of each node numbered contiguously; using per-rank chunks\n";
+        opts.shm = false;
+    }
+
+    vector<Entry> all_entries, local_entries;
+    vector<EntryView> local_view;  // the lines this rank searches
 
     if (rank == 0) {
         // --- MASTER PROCESS ---
-        vector<string> files;
-        for (int i = 1; i < argc - 1; i++) files.push_back(argv[i]);
-
-        vector<Entry> all_entries;
+        vector<string> files(argv + first_arg, argv + argc - 1);
         read_phonebook(files, all_entries);
 
-        int total = all_entries.size();
-        int chunk = (total + size - 1) / size;
+        long long total = all_entries.size();
+        long long chunk = (total + size - 1) / size;
 
         // Distribute data to workers
-        for (int i = 1; i < size; i++) {
+        for (int i = 1; i < size && !opts.shm; i++) {
             string text_chunk = entries_to_string(all_entries, i * chunk, (i + 1) * chunk);
             send_string(text_chunk, i);
         }
 
-        // Start global timer
-        start_time = MPI_Wtime();
+        // The master keeps the first chunk for itself
+        if (!opts.shm) {
+            all_entries.resize(min(chunk, total));
+            local_entries.swap(all_entries);
+        }
+    } else if (!opts.shm) {
+        // --- WORKER PROCESS ---
+        string recv_text = receive_string(0);
+        local_entries = string_to_entries(recv_text);
+    }
 
-        // --- MASTER CHUNK SEARCH ---
-        double master_start = MPI_Wtime();
-        vector<Entry> final_matches;
-        for (int i = 0; i < min(chunk, total); i++) {
-            string lower_line = to_lower(all_entries[i].text);
-            if (lower_line.find(lower_term) != string::npos) {
-                final_matches.push_back(all_entries[i]);
-            }
+    if (opts.shm) {
+        // Each node receives its part once and searches it in shared memory
+        string_view node_text = node_shard_text(node, all_entries.size(), [&](long long first, long long last) {
+            return entries_to_string(all_entries, first, last);
+        }, &shard_win);
+        vector<Entry>().swap(all_entries);
+        local_view = string_to_entry_views(node_text);
+    } else {
+        for (const Entry &e : local_entries) local_view.push_back({e.line_number, e.text});
+    }
+
+    // Start global timer
+    if (rank == 0) start_time = MPI_Wtime();
+
+    // Result order (see sort_entries); ties are broken by line number so
+    // that top-K and the sample sort splitters are well defined. Bytes are
+    // folded one at a time, without building lower-cased copies.
+    auto folded_less = [](unsigned char x, unsigned char y) { return tolower(x) < tolower(y); };
+    auto entry_less = [&](const Entry &a, const Entry &b) {
+        if (lexicographical_compare(a.text.begin(), a.text.end(), b.text.begin(), b.text.end(), folded_less)) {
+            return true;
         }
-        double master_end = MPI_Wtime();
-        printf("Master process searched %d lines in %f seconds.\n",
-               min(chunk, total), master_end - master_start);
-
-        // Receive results from workers
-        for (int i = 1; i < size; i++) {
-            string worker_raw_res = receive_string(i);
-            vector<Entry> worker_vec = string_to_entries(worker_raw_res);
-            final_matches.insert(final_matches.end(), worker_vec.begin(), worker_vec.end());
+        if (lexicographical_compare(b.text.begin(), b.text.end(), a.text.begin(), a.text.end(), folded_less)) {
+            return false;
         }
+        return a.line_number < b.line_number;
+    };
 
-        // Sort results alphabetically by text (case-insensitive)
-        sort(final_matches.begin(), final_matches.end(),
-             [](const Entry &a, const Entry &b) {
-                 return to_lower(a.text) < to_lower(b.text);
-             });
+    // Distance of a line to the search term: 0 for an exact (or --regex)
+    // match, the edit distance (at most --max-errors) in fuzzy mode, -1 when
+    // it does not match
+    MyersPattern fuzzy_pattern = myers_compile(search_term, true);
+    auto match_distance = [&](string_view text) {
+        if (opts.regex) return regex_search(dfa, text) ? 0 : -1;
+        if (opts.max_errors < 0) return to_lower(text).find(lower_term) != string::npos ? 0 : -1;
+        int d = myers_distance(fuzzy_pattern, text.data(), text.size());
+        return d <= opts.max_errors ? d : -1;
+    };
 
-        end_time = MPI_Wtime();
+    // --- LOCAL CHUNK SEARCH ---
+    // Matches are grouped by distance; an exact search has only distance 0,
+    // and no distance exceeds the term length (delete every term byte)
+    PerfCounters perf = {{0}, 0};
+    long long counts[PERF_EVENTS];
+    if (opts.perf) perf_start(&perf);
+    double local_start = MPI_Wtime();
+    vector<vector<Entry>> local_matches(min(max(opts.max_errors, 0), (int)search_term.size()) + 1);
+    long long local_count = 0;
+    bool found = false;
+    if (opts.mode == RESULT_EXISTS) {
+        found = exists_scan(local_view.size(), [&](size_t i) {
+            return match_distance(local_view[i].text) >= 0;
+        }, MPI_COMM_WORLD);
+    } else {
+        for (const EntryView &e : local_view) {
+            int d = match_distance(e.text);
+            if (d < 0) continue;
+            local_count++;
+            if (opts.mode == RESULT_ALL) {
+                local_matches[d].push_back({e.line_number, string(e.text)});
+            } else if (opts.mode == RESULT_TOP_K) {
+                keep_top_k(local_matches[0], Entry{e.line_number, string(e.text)}, opts.top_k, entry_less);
+            }
+        }
+    }
+    double local_end = MPI_Wtime();
+    if (opts.perf) perf_stop(&perf, counts);
+    printf("Process %d processed %lu lines in %f seconds.\n",
+           rank, local_view.size(), local_end - local_start);
+    if (opts.perf) report_perf("search loop", &perf, counts, local_view.size(), "line", MPI_COMM_WORLD);
 
-        // Write results with line numbers
-        ofstream out("output.txt");
-        for (const Entry &match : final_matches) {
-            out << match.line_number << ": " << match.text << "\n";
+    int status = 0;  // 1 if output.txt could not be written
+    if (opts.mode == RESULT_COUNT) {
+        long long total_count = 0;
+        MPI_Reduce(&local_count, &total_count, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (rank == 0) {
+            end_time = MPI_Wtime();
+            write_summary(to_string(total_count));
+            cout << "Search complete. Found " << total_count << " matches." << endl;
+            printf("Total execution time (distribution + search + reduce): %f seconds.\n", end_time - start_time);
+        }
+    } else if (opts.mode == RESULT_EXISTS) {
+        if (rank == 0) {
+            end_time = MPI_Wtime();
+            write_summary(found ? "yes" : "no");
+            cout << "Search complete. " << (found ? "Match found." : "No match found.") << endl;
+            printf("Total execution time (distribution + search): %f seconds.\n", end_time - start_time);
         }
-        out.close();
+    } else {
+        // With --sample-sort every rank ends up holding one sorted range of the
+        // result, so the root only has to concatenate the ranges in rank order
+        if (opts.sample_sort) {
+            sample_sort(local_matches[0], entry_less, sort_entries, entries_to_string, string_to_entries, MPI_COMM_WORLD);
+        }
+
+        if (opts.mpi_io) {
+            // Every rank writes its own range of output.txt
+            string out_text;
+            for (const Entry &match : local_matches[0]) {
+                out_text += to_string(match.line_number) + ": " + match.text + "\n";
+            }
+            if (!write_ordered("output.txt", out_text, MPI_COMM_WORLD)) status = 1;
 
-        cout << "Search complete. Found " << final_matches.size() << " matches." << endl;
-        printf("Total execution time (distribution + search + gather + sort): %f seconds.\n",
-               end_time - start_time);
+            long long local_found = local_matches[0].size(), total_found = 0;
+            MPI_Reduce(&local_found, &total_found, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+            if (rank == 0 && !status) {
+                end_time = MPI_Wtime();
+                cout << "Search complete. Found " << total_found << " matches." << endl;
+                printf("Total execution time (distribution + search + sort + write): %f seconds.\n", end_time - start_time);
+            }
+        } else if (rank != 0) {
+            // Send local results (all matches, or the local top K) back to
+            // Master, one message per distance
+            for (const vector<Entry> &matches : local_matches) {
+                send_string(entries_to_string(matches, 0, matches.size()), 0);
+            }
+        } else {
+            // Receive results from workers; fuzzy results are ranked by
+            // distance first, then in the usual order
+            vector<Entry> final_matches;
+            for (vector<Entry> &matches : local_matches) {
+                for (int i = 1; i < size; i++) {
+                    string worker_raw_res = receive_string(i);
+                    vector<Entry> worker_vec = string_to_entries(worker_raw_res);
+                    matches.insert(matches.end(), worker_vec.begin(), worker_vec.end());
+                }
 
-    } else {
-        // --- WORKER PROCESS ---
-        string recv_text = receive_string(0);
-        vector<Entry> local_entries = string_to_entries(recv_text);
-        
-        double worker_start = MPI_Wtime();
-        string local_matches_str = "";
-        for (const Entry &entry : local_entries) {
-            string lower_line = to_lower(entry.text);
-            if (lower_line.find(lower_term) != string::npos) {
-                local_matches_str += to_string(entry.line_number) + "|" + entry.text + "\n";
+                if (opts.sample_sort) {
+                    // The ranges arrive already in global order
+                } else {
+                    // Sort results alphabetically by text (case-insensitive)
+                    sort_entries(matches);
+                }
+                final_matches.insert(final_matches.end(), matches.begin(), matches.end());
             }
+            // In top-K mode only K candidates per rank arrive here
+            if (opts.mode == RESULT_TOP_K && (int)final_matches.size() > opts.top_k) {
+                final_matches.resize(opts.top_k);
+            }
+
+            end_time = MPI_Wtime();
+
+            // Write results with line numbers
+            ofstream out("output.txt");
+            for (const Entry &match : final_matches) {
+                out << match.line_number << ": " << match.text << "\n";
+            }
+            out.close();
+
+            cout << "Search complete. Found " << final_matches.size() << " matches." << endl;
+            printf("Total execution time (distribution + search + gather + sort): %f seconds.\n",
+                   end_time - start_time);
         }
-        double worker_end = MPI_Wtime();
+    }
 
-        // Send local results back to Master
-        send_string(local_matches_str, 0);
-        printf("Process %d processed %lu lines in %f seconds.\n",
-               rank, local_entries.size(), worker_end - worker_start);
+    if (opts.shm) {
+        node_shared_free(&shard_win);
+        node_info_free(&node);
     }
 
     MPI_Finalize();
-    return 0;
+    return status;
 }
@@ -0,0 +1,445 @@
+#ifndef REGEX_DFA_H
+#define REGEX_DFA_H
+
+#include <bits/stdc++.h>
+#include <mpi.h>
+
+using namespace std;
+
+// --regex: the pattern is compiled once into a table-driven DFA (Thompson
+// NFA, then subset construction), so every line is scanned in a single pass
+// with no backtracking. Syntax: literal bytes, \ escapes (\d \w \s for
+// digits, word bytes and spaces), ., [...] classes with ranges and ^
+// negation, * + ?, | and ( ). ^ and $ anchor the whole pattern to the start
+// and end of the line. Like the substring search, a line matches when any
+// part of it matches.
+
+// A compiled pattern. Plain arrays only, so rank 0 can broadcast it.
+struct RegexDfa {
+    int classes = 0;          // byte equivalence classes (table columns)
+    int start = 1;
+    bool anchored_end = false;
+    bool fold = false;        // case-insensitive
+    int byte_class[256];
+    vector<int> next;         // next[state * classes + class]; state 0 is dead
+    vector<char> accept;
+    string literal;           // a string every match contains, for prefiltering
+    int skip[256];            // Horspool shifts of literal, when fold is set
+};
+
+// Most states a pattern may compile to
+const int REGEX_MAX_STATES = 10000;
+
+namespace regex_detail {
+
+struct NfaState {
+    enum Type { CHAR, SPLIT, EPS, MATCH } type;
+    bitset<256> set;  // CHAR: the bytes that lead to out
+    int out = -1, out1 = -1;
+};
+
+// A piece of NFA under construction: its start and the dangling exits
+// (state, 0 for out / 1 for out1) still to be connected
+struct Frag {
+    int start;
+    vector<pair<int, int>> outs;
+};
+
+struct Parser {
+    const string &p;
+    bool fold;
+    size_t pos = 0;
+    int depth = 0;
+    vector<NfaState> states;
+    string error;
+    string best_literal, run;  // required literal of the top-level sequence
+    bool top_level_alt = false;
+
+    Parser(const string &pattern, bool fold) : p(pattern), fold(fold) {}
+
+    int add(NfaState::Type type, const bitset<256> &set = bitset<256>()) {
+        states.push_back({type, set});
+        return states.size() - 1;
+    }
+
+    void patch(const vector<pair<int, int>> &outs, int target) {
+        for (auto [s, slot] : outs) (slot ? states[s].out1 : states[s].out) = target;
+    }
+
+    bool fail(const string &msg) {
+        if (error.empty()) error = msg + " at position " + to_string(pos);
+        return false;
+    }
+
+    void end_run() {
+        if (run.size() > best_literal.size()) best_literal = run;
+        run.clear();
+    }
+
+    bitset<256> folded(bitset<256> set) {
+        if (!fold) return set;
+        for (int c = 0; c < 256; c++) {
+            if (set[c]) {
+                set[tolower(c)] = true;
+                set[toupper(c)] = true;
+            }
+        }
+        return set;
+    }
+
+    bitset<256> escape_set(unsigned char c) {
+        bitset<256> set;
+        for (int b = 0; b < 256; b++) {
+            if ((c == 'd' && isdigit(b)) || (c == 'w' && (isalnum(b) || b == '_')) || (c == 's' && isspace(b)))
+                set[b] = true;
+        }
+        if (c != 'd' && c != 'w' && c != 's') set[c] = true;
+        return set;
+    }
+
+    bool parse_class(bitset<256> &set) {
+        bool negate = pos < p.size() && p[pos] == '^';
+        if (negate) pos++;
+        bool first = true;
+        while (pos < p.size() && (p[pos] != ']' || first)) {
+            first = false;
+            unsigned char lo = p[pos++];
+            if (lo == '\\' && pos < p.size()) {
+                unsigned char e = p[pos++];
+                if (e == 'd' || e == 'w' || e == 's') {
+                    set |= escape_set(e);
+                    continue;
+                }
+                lo = e;
+            }
+            unsigned char hi = lo;
+            if (pos + 1 < p.size() && p[pos] == '-' && p[pos + 1] != ']') {
+                hi = p[pos + 1];
+                pos += 2;
+                if (hi == '\\' && pos < p.size()) hi = p[pos++];
+                if (hi < lo) return fail("invalid range in class");
+            }
+            for (int c = lo; c <= hi; c++) set[c] = true;
+        }
+        if (pos >= p.size()) return fail("missing ]");
+        pos++;
+        set = folded(set);
+        if (negate) set.flip();
+        return true;
+    }
+
+    // atom := literal | \x | . | [class] | ( alt )
+    // literal is set to the byte of a plain literal atom, -1 otherwise
+    bool parse_atom(Frag &f, int &literal) {
+        literal = -1;
+        unsigned char c = p[pos++];
+        bitset<256> set;
+        if (c == '(') {
+            depth++;
+            if (!parse_alt(f)) return false;
+            depth--;
+            if (pos >= p.size() || p[pos] != ')') return fail("missing )");
+            pos++;
+            return true;
+        } else if (c == '.') {
+            set.set();
+        } else if (c == '[') {
+            if (!parse_class(set)) return false;
+        } else if (c == '\\') {
+            if (pos >= p.size()) return fail("trailing \\");
+            unsigned char e = p[pos++];
+            set = folded(escape_set(e));
+            if (e != 'd' && e != 'w' && e != 's') literal = e;
+        } else if (c == '*' || c == '+' || c == '?') {
+            return fail("nothing to repeat");
+        } else if (c == '^' || c == '$') {
+            return fail("^ and $ are only supported at the ends of the pattern");
+        } else {
+            set[c] = true;
+            set = folded(set);
+            literal = c;
+        }
+        int s = add(NfaState::CHAR, set);
+        f = {s, {{s, 0}}};
+        return true;
+    }
+
+    // repeat := atom ( * | + | ? )*
+    bool parse_repeat(Frag &f) {
+        int literal;
+        if (!parse_atom(f, literal)) return false;
+        bool repeated = false, optional = false;
+        while (pos < p.size() && (p[pos] == '*' || p[pos] == '+' || p[pos] == '?')) {
+            char op = p[pos++];
+            int s = add(NfaState::SPLIT);
+            states[s].out = f.start;
+            if (op == '?') {
+                f.outs.push_back({s, 1});
+                f.start = s;
+                optional = true;
+            } else {
+                patch(f.outs, s);
+                f.outs = {{s, 1}};
+                if (op == '*') {
+                    f.start = s;
+                    optional = true;
+                }
+                repeated = true;
+            }
+        }
+
+        // Only plain literals of the top-level sequence count towards the
+        // prefilter: x+ still has to contain x, but ends the run after it
+        if (depth == 0) {
+            char c = fold ? tolower(literal) : literal;
+            if (literal < 0 || optional) {
+                end_run();
+            } else {
+                run += c;
+                if (repeated) {
+                    end_run();
+                    run = string(1, c);
+                }
+            }
+        }
+        return true;
+    }
+
+    // concat := repeat*, empty matches the empty string
+    bool parse_concat(Frag &f) {
+        int e = add(NfaState::EPS);
+        f = {e, {{e, 0}}};
+        while (pos < p.size() && p[pos] != '|' && p[pos] != ')') {
+            Frag next;
+            if (!parse_repeat(next)) return false;
+            patch(f.outs, next.start);
+            f.outs = next.outs;
+        }
+        return true;
+    }
+
+    // alt := concat ( | concat )*
+    bool parse_alt(Frag &f) {
+        if (!parse_concat(f)) return false;
+        while (pos < p.size() && p[pos] == '|') {
+            pos++;
+            // Literals of one branch are not required by the others
+            if (depth == 0) top_level_alt = true;
+            Frag other;
+            if (!parse_concat(other)) return false;
+            int s = add(NfaState::SPLIT);
+            states[s].out = f.start;
+            states[s].out1 = other.start;
+            f.start = s;
+            f.outs.insert(f.outs.end(), other.outs.begin(), other.outs.end());
+        }
+        if (depth == 0) {
+            end_run();
+            if (top_level_alt) best_literal.clear();
+        }
+        return true;
+    }
+};
+
+// Adds the states reachable from set without reading a byte. Only CHAR and
+// MATCH states are kept, which makes equal DFA states compare equal.
+inline void closure(const vector<NfaState> &nfa, vector<int> &set, vector<int> &seen, int mark) {
+    vector<int> stack(set.begin(), set.end()), result;
+    while (!stack.empty()) {
+        int s = stack.back();
+        stack.pop_back();
+        if (s < 0 || seen[s] == mark) continue;
+        seen[s] = mark;
+        const NfaState &st = nfa[s];
+        if (st.type == NfaState::SPLIT) {
+            stack.push_back(st.out1);
+            stack.push_back(st.out);
+        } else if (st.type == NfaState::EPS) {
+            stack.push_back(st.out);
+        } else {
+            result.push_back(s);
+        }
+    }
+    sort(result.begin(), result.end());
+    set.swap(result);
+}
+
+}  // namespace regex_detail
+
+// Compiles pattern into dfa. Returns false with a message in error when the
+// pattern is invalid or needs more than REGEX_MAX_STATES states.
+inline bool regex_compile(const string &pattern, bool fold, RegexDfa &dfa, string &error) {
+    using namespace regex_detail;
+
+    string body = pattern;
+    bool anchored_start = !body.empty() && body[0] == '^';
+    if (anchored_start) body.erase(0, 1);
+    size_t slashes = 0;
+    while (slashes + 1 < body.size() && body[body.size() - 2 - slashes] == '\\') slashes++;
+    dfa.anchored_end = !body.empty() && body.back() == '$' && slashes % 2 == 0;
+    if (dfa.anchored_end) body.pop_back();
+
+    Parser parser(body, fold);
+    Frag f;
+    bool ok = parser.parse_alt(f);
+    if (ok && parser.pos < body.size()) ok = parser.fail("unmatched )");
+    if (!ok) {
+        error = parser.error;
+        return false;
+    }
+    int match = parser.add(NfaState::MATCH);
+    parser.patch(f.outs, match);
+    const vector<NfaState> &nfa = parser.states;
+    dfa.fold = fold;
+    dfa.literal = parser.best_literal;
+
+    // Bytes that every CHAR state treats alike share one table column
+    vector<int> char_states;
+    for (int s = 0; s < (int)nfa.size(); s++) {
+        if (nfa[s].type == NfaState::CHAR) char_states.push_back(s);
+    }
+    map<vector<bool>, int> class_of;
+    vector<int> representative;
+    for (int c = 0; c < 256; c++) {
+        vector<bool> signature;
+        for (int s : char_states) signature.push_back(nfa[s].set[c]);
+        auto it = class_of.find(signature);
+        if (it == class_of.end()) {
+            it = class_of.emplace(signature, representative.size()).first;
+            representative.push_back(c);
+        }
+        dfa.byte_class[c] = it->second;
+    }
+    dfa.classes = representative.size();
+
+    // Subset construction. Without ^ the NFA start is re-entered at every
+    // byte, so a match may begin anywhere in the line.
+    vector<int> seen(nfa.size(), -1);
+    int mark = 0;
+    vector<int> start_set = {f.start};
+    closure(nfa, start_set, seen, mark++);
+
+    map<vector<int>, int> id;
+    vector<vector<int>> sets = {{}, start_set};
+    id[{}] = 0;
+    id[start_set] = 1;
+    dfa.start = 1;
+    dfa.next.assign(2 * dfa.classes, 0);
+
+    for (size_t d = 1; d < sets.size(); d++) {
+        for (int k = 0; k < dfa.classes; k++) {
+            vector<int> moved;
+            for (int s : sets[d]) {
+                if (nfa[s].type == NfaState::CHAR && nfa[s].set[representative[k]]) moved.push_back(nfa[s].out);
+            }
+            if (!anchored_start) moved.push_back(f.start);
+            closure(nfa, moved, seen, mark++);
+
+            auto it = id.find(moved);
+            if (it == id.end()) {
+                if ((int)sets.size() >= REGEX_MAX_STATES) {
+                    error = "pattern needs more than " + to_string(REGEX_MAX_STATES) + " DFA states";
+                    return false;
+                }
+                it = id.emplace(moved, sets.size()).first;
+                sets.push_back(moved);
+                dfa.next.resize(sets.size() * dfa.classes, 0);
+            }
+            dfa.next[d * dfa.classes + k] = it->second;
+        }
+    }
+
+    dfa.accept.assign(sets.size(), 0);
+    for (size_t d = 0; d < sets.size(); d++) {
+        dfa.accept[d] = binary_search(sets[d].begin(), sets[d].end(), match);
+    }
+    return true;
+}
+
+inline void regex_prepare_literal(RegexDfa &dfa) {
+    int m = dfa.literal.size();
+    fill(dfa.skip, dfa.skip + 256, max(m, 1));
+    for (int i = 0; i + 1 < m; i++) {
+        unsigned char c = dfa.literal[i];
+        dfa.skip[c] = dfa.skip[toupper(c)] = m - 1 - i;
+    }
+}
+
+// Compiles the pattern on root and broadcasts the DFA to every rank of comm.
+// Returns false on every rank (after printing the reason on root) when the
+// pattern is invalid.
+inline bool regex_bcast(const string &pattern, bool fold, RegexDfa &dfa, int root, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    // classes, start, anchored_end, fold, states, literal length, then the
+    // byte classes, the table, the accept flags and the literal
+    vector<int> packed;
+    if (rank == root) {
+        string error;
+        if (regex_compile(pattern, fold, dfa, error)) {
+            packed = {dfa.classes, dfa.start, dfa.anchored_end, dfa.fold, (int)dfa.accept.size(),
+                      (int)dfa.literal.size()};
+            packed.insert(packed.end(), dfa.byte_class, dfa.byte_class + 256);
+            packed.insert(packed.end(), dfa.next.begin(), dfa.next.end());
+            packed.insert(packed.end(), dfa.accept.begin(), dfa.accept.end());
+            packed.insert(packed.end(), dfa.literal.begin(), dfa.literal.end());
+        } else {
+            cerr << "Invalid --regex pattern: " << error << "\n";
+        }
+    }
+
+    int n = packed.size();
+    MPI_Bcast(&n, 1, MPI_INT, root, comm);
+    if (n == 0) return false;
+    packed.resize(n);
+    MPI_Bcast(packed.data(), n, MPI_INT, root, comm);
+
+    if (rank != root) {
+        dfa.classes = packed[0];
+        dfa.start = packed[1];
+        dfa.anchored_end = packed[2];
+        dfa.fold = packed[3];
+        int states = packed[4], literal_len = packed[5];
+        const int *p = packed.data() + 6;
+        copy(p, p + 256, dfa.byte_class);
+        p += 256;
+        dfa.next.assign(p, p + states * dfa.classes);
+        p += states * dfa.classes;
+        dfa.accept.assign(p, p + states);
+        p += states;
+        dfa.literal.assign(p, p + literal_len);
+    }
+    regex_prepare_literal(dfa);
+    return true;
+}
+
+// Whether the literal occurs in text (case-insensitively with fold, by
+// Horspool over lower-cased bytes; the literal is already lower-case)
+inline bool regex_literal_in(const RegexDfa &dfa, string_view text) {
+    if (!dfa.fold) return text.find(dfa.literal) != string_view::npos;
+    int m = dfa.literal.size();
+    for (size_t i = 0; i + m <= text.size(); i += dfa.skip[(unsigned char)text[i + m - 1]]) {
+        int j = m - 1;
+        while (j >= 0 && tolower((unsigned char)text[i + j]) == (unsigned char)dfa.literal[j]) j--;
+        if (j < 0) return true;
+    }
+    return false;
+}
+
+// Whether any part of text matches. Lines without the required literal are
+// rejected before the DFA runs; the DFA stops at its first accepting state
+// (unless the pattern ends in $) or once it reaches the dead state.
+inline bool regex_search(const RegexDfa &dfa, string_view text) {
+    if (!dfa.literal.empty() && !regex_literal_in(dfa, text)) return false;
+    int s = dfa.start;
+    if (dfa.accept[s] && !dfa.anchored_end) return true;
+    for (unsigned char c : text) {
+        s = dfa.next[s * dfa.classes + dfa.byte_class[c]];
+        if (s == 0) return false;
+        if (dfa.accept[s] && !dfa.anchored_end) return true;
+    }
+    return dfa.accept[s];
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef SAMPLE_SORT_H
+#define SAMPLE_SORT_H
+
+#include <bits/stdc++.h>
+#include <mpi.h>
+#include "large_count.h"
+
+using namespace std;
+
+// Gathers one string from every rank of comm, concatenated in rank order.
+// Only used for the splitter samples, so the total must fit in an int.
+inline string allgather_string(const string &local, MPI_Comm comm) {
+    int size;
+    MPI_Comm_size(comm, &size);
+
+    int len = local.size();
+    vector<int> lens(size), displs(size);
+    MPI_Allgather(&len, 1, MPI_INT, lens.data(), 1, MPI_INT, comm);
+    long long total = 0;
+    for (int i = 0; i < size; i++) {
+        displs[i] = total;
+        total += lens[i];
+    }
+    if (total > INT_MAX) {
+        cerr << "allgather_string: " << total << " bytes do not fit in an MPI count" << endl;
+        MPI_Abort(comm, 1);
+    }
+
+    string all(total, '\0');
+    MPI_Allgatherv(local.data(), len, MPI_CHAR, &all[0], lens.data(), displs.data(), MPI_CHAR, comm);
+    return all;
+}
+
+// Distributed sample sort. On return every rank holds a sorted range of the
+// global order (by less, which must be a strict total order so that all ranks
+// agree on the splitters), and the range of rank r precedes that of rank r+1.
+// sort_items(items) sorts a local vector in that same order.
+//
+// Each rank sorts its items and contributes size-1 regular samples; the
+// gathered samples give size-1 splitters, and the buckets they cut out of the
+// local runs are exchanged with alltoallv_bytes (one MPI_Alltoallv unless a
+// bucket passes MPI_CHUNK_BYTES). Items travel in the
+// program's own text format: pack(items, start, end) serialises a range and
+// unpack(text) parses it back.
+template <class T, class Less, class Sort, class Pack, class Unpack>
+void sample_sort(vector<T> &items, Less less, Sort sort_items, Pack pack, Unpack unpack, MPI_Comm comm) {
+    int size;
+    MPI_Comm_size(comm, &size);
+
+    sort_items(items);
+    if (size == 1) return;
+
+    long long n = items.size();
+    vector<T> samples;
+    for (int i = 1; i < size && n > 0; i++) {
+        samples.push_back(items[i * n / size]);
+    }
+    vector<T> all_samples = unpack(allgather_string(pack(samples, 0, samples.size()), comm));
+    sort_items(all_samples);
+
+    // Bucket r receives the items in (splitter r-1, splitter r]
+    vector<long long> bounds(size + 1, n);
+    bounds[0] = 0;
+    if (!all_samples.empty()) {
+        for (int r = 1; r < size; r++) {
+            const T &splitter = all_samples[(long long)r * all_samples.size() / size];
+            bounds[r] = upper_bound(items.begin(), items.end(), splitter, less) - items.begin();
+        }
+    }
+
+    string sendbuf;
+    vector<long long> sendcounts(size), sdispls(size), recvcounts(size), rdispls(size);
+    for (int r = 0; r < size; r++) {
+        string bucket = pack(items, bounds[r], bounds[r + 1]);
+        sdispls[r] = sendbuf.size();
+        sendcounts[r] = bucket.size();
+        sendbuf += bucket;
+    }
+    MPI_Alltoall(sendcounts.data(), 1, MPI_LONG_LONG, recvcounts.data(), 1, MPI_LONG_LONG, comm);
+    long long total = 0;
+    for (int r = 0; r < size; r++) {
+        rdispls[r] = total;
+        total += recvcounts[r];
+    }
+
+    string recvbuf(total, '\0');
+    alltoallv_bytes(sendbuf.data(), sendcounts.data(), sdispls.data(),
+                    &recvbuf[0], recvcounts.data(), rdispls.data(), comm);
+
+    items = unpack(recvbuf);
+    sort_items(items);
+}
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef SEARCH_MODES_H
+#define SEARCH_MODES_H
+
+#include <bits/stdc++.h>
+#include <mpi.h>
+
+using namespace std;
+
+// What the phone_book programs report back to the root
+enum ResultMode {
+    RESULT_ALL,     // every matching line, sorted (the default)
+    RESULT_COUNT,   // only the number of matches
+    RESULT_EXISTS,  // only whether there is a match at all
+    RESULT_TOP_K    // the first K matches in sorted order
+};
+
+// Command line options shared by the phone_book programs
+struct SearchOptions {
+    ResultMode mode = RESULT_ALL;
+    int top_k = 0;
+    bool sample_sort = false;   // sort matches with a distributed sample sort
+    bool mpi_io = false;        // every rank writes its sorted range of output.txt
+    bool shm = false;           // share one copy of the input per node (node_shm.h)
+    int max_errors = -1;        // fuzzy search within this edit distance when >= 0
+    bool regex = false;         // the search term is a pattern (regex_dfa.h)
+    bool phone_prefix = false;  // phone_book only
+    bool perf = false;          // hardware counters around the search loop (perf_counters.h)
+};
+
+// Parses a whole decimal argument in [lo, INT_MAX] into out
+inline bool parse_int_arg(const char *arg, int lo, int &out) {
+    char *end;
+    errno = 0;
+    long v = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno == ERANGE || v < lo || v > INT_MAX) return false;
+    out = v;
+    return true;
+}
+
+// Parses the leading --options. Returns the index of the first file argument,
+// or -1 (after printing the reason on rank 0) when an option is invalid.
+inline int parse_search_options(int argc, char **argv, SearchOptions &opts, int rank) {
+    int i = 1;
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+        string opt = argv[i];
+        if (opt == "--count") {
+            opts.mode = RESULT_COUNT;
+        } else if (opt == "--exists") {
+            opts.mode = RESULT_EXISTS;
+        } else if (opt == "--top" && i + 1 < argc && parse_int_arg(argv[i + 1], 1, opts.top_k)) {
+            opts.mode = RESULT_TOP_K;
+            i++;
+        } else if (opt == "--sample-sort") {
+            opts.sample_sort = true;
+        } else if (opt == "--mpi-io") {
+            // Ranks can only write in place once each holds one sorted range
+            opts.mpi_io = true;
+            opts.sample_sort = true;
+        } else if (opt == "--max-errors" && i + 1 < argc && parse_int_arg(argv[i + 1], 0, opts.max_errors)) {
+            i++;
+        } else if (opt == "--regex") {
+            opts.regex = true;
+        } else if (opt == "--shm") {
+            opts.shm = true;
+        } else if (opt == "--phone") {
+            opts.phone_prefix = true;
+        } else if (opt == "--perf") {
+            opts.perf = true;
+        } else {
+            if (rank == 0) cerr << "Unknown or incomplete option: " << opt << "\n";
+            return -1;
+        }
+    }
+    if (opts.sample_sort && opts.mode != RESULT_ALL) {
+        if (rank == 0) cerr << "--sample-sort and --mpi-io only apply when all matches are returned\n";
+        return -1;
+    }
+    if (opts.phone_prefix && (opts.shm || opts.sample_sort)) {
+        if (rank == 0) cerr << "--shm, --sample-sort and --mpi-io cannot be combined with --phone\n";
+        return -1;
+    }
+    if (opts.max_errors >= 0 && (opts.mode == RESULT_TOP_K || opts.sample_sort || opts.phone_prefix)) {
+        if (rank == 0) cerr << "--max-errors cannot be combined with --top, --sample-sort, --mpi-io or --phone\n";
+        return -1;
+    }
+    if (opts.regex && (opts.max_errors >= 0 || opts.phone_prefix)) {
+        if (rank == 0) cerr << "--regex cannot be combined with --max-errors or --phone\n";
+        return -1;
+    }
+    return i;
+}
+
+// Tag of the stop messages sent by the exists mode
+const int STOP_TAG = 2;
+
+// Calls match(i) for i in [0, n) until it returns true, like a plain scan,
+// but also stops once any other rank of comm has found a match. A rank that
+// matches posts a nonblocking stop message to every other rank; the others
+// poll for it every 1024 lines. Returns, on every rank, whether any rank
+// found a match.
+template <class Match>
+bool exists_scan(size_t n, Match match, MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    int stop_msg = 0;
+    MPI_Request stop_req;
+    MPI_Irecv(&stop_msg, 1, MPI_INT, MPI_ANY_SOURCE, STOP_TAG, comm, &stop_req);
+
+    int found = 0, stopped = 0;
+    for (size_t i = 0; i < n && !found && !stopped; i++) {
+        if (match(i)) {
+            found = 1;
+        } else if ((i & 1023) == 1023) {
+            MPI_Test(&stop_req, &stopped, MPI_STATUS_IGNORE);
+        }
+    }
+
+    vector<MPI_Request> sends;
+    if (found) {
+        for (int r = 0; r < size; r++) {
+            if (r == rank) continue;
+            sends.emplace_back();
+            MPI_Isend(&found, 1, MPI_INT, r, STOP_TAG, comm, &sends.back());
+        }
+    }
+
+    // Every rank learns how many ranks matched, so it can drain exactly the
+    // stop messages addressed to it and leave none unmatched
+    int finders = 0;
+    MPI_Allreduce(&found, &finders, 1, MPI_INT, MPI_SUM, comm);
+    int expected = finders - found;
+    if (expected == 0) {
+        MPI_Cancel(&stop_req);
+        MPI_Wait(&stop_req, MPI_STATUS_IGNORE);
+    } else {
+        MPI_Wait(&stop_req, MPI_STATUS_IGNORE);
+        for (int i = 1; i < expected; i++) {
+            MPI_Recv(&stop_msg, 1, MPI_INT, MPI_ANY_SOURCE, STOP_TAG, comm, MPI_STATUS_IGNORE);
+        }
+    }
+    MPI_Waitall(sends.size(), sends.data(), MPI_STATUSES_IGNORE);
+    return finders > 0;
+}
+
+// Keeps the k smallest items seen so far (by less) in a bounded max-heap
+template <class T, class Less>
+void keep_top_k(vector<T> &heap, const T &item, size_t k, Less less) {
+    if (heap.size() < k) {
+        heap.push_back(item);
+        push_heap(heap.begin(), heap.end(), less);
+    } else if (less(item, heap.front())) {
+        pop_heap(heap.begin(), heap.end(), less);
+        heap.back() = item;
+        push_heap(heap.begin(), heap.end(), less);
+    }
+}
+
+// Writes the answer of the count and exists modes to output.txt
+inline void write_summary(const string &summary) {
+    ofstream out("output.txt");
+    out << summary << "\n";
+    out.close();
+}
+
+#endif
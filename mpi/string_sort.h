@@ -0,0 +1,87 @@
+#ifndef STRING_SORT_H
+#define STRING_SORT_H
+
+#include <bits/stdc++.h>
+
+using namespace std;
+
+// Cached sort key: the next 8 bytes of an item's text, packed big-endian so
+// that comparing two keys as integers compares the bytes as unsigned chars,
+// which is the order of std::string::operator<. The index is 64-bit since
+// it would be padded to 16 bytes anyway, so there is no limit on the items.
+struct TextSortKey {
+    uint64_t prefix;
+    uint64_t index;
+};
+
+inline uint64_t load_text_prefix(const char *s, size_t len, size_t depth, bool fold) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (!fold && depth + 8 <= len) {
+        uint64_t word;
+        memcpy(&word, s + depth, 8);
+        return __builtin_bswap64(word);
+    }
+#endif
+    uint64_t key = 0;
+    for (size_t b = depth; b < depth + 8; b++) {
+        unsigned char c = b < len ? s[b] : 0;
+        if (fold) c = tolower(c);
+        key = (key << 8) | c;
+    }
+    return key;
+}
+
+// MSD radix sort over 64-bit digits: sorts keys[0, n) by the 8 text bytes at
+// depth, then recurses into every run that shares them. Items whose text ends
+// within the digit are complete in that run (texts contain no NUL bytes), so
+// they are equal, sort first and are ordered by tie(index).
+template <class Text, class Tie>
+void text_radix_sort(TextSortKey *keys, size_t n, size_t depth, bool fold, Text &text, Tie &tie) {
+    for (size_t i = 0; i < n; i++) {
+        const auto &t = text(keys[i].index);
+        keys[i].prefix = load_text_prefix(t.data(), t.size(), depth, fold);
+    }
+    sort(keys, keys + n, [](const TextSortKey &a, const TextSortKey &b) {
+        return a.prefix < b.prefix;
+    });
+
+    for (size_t lo = 0, hi; lo < n; lo = hi) {
+        hi = lo + 1;
+        while (hi < n && keys[hi].prefix == keys[lo].prefix) hi++;
+        if (hi - lo == 1) continue;
+
+        TextSortKey *mid = stable_partition(keys + lo, keys + hi, [&](const TextSortKey &k) {
+            return text(k.index).size() <= depth + 8;
+        });
+        sort(keys + lo, mid, [&](const TextSortKey &a, const TextSortKey &b) {
+            auto ta = tie(a.index), tb = tie(b.index);
+            return ta != tb ? ta < tb : a.index < b.index;
+        });
+        if (keys + hi - mid > 1) text_radix_sort(mid, keys + hi - mid, depth + 8, fold, text, tie);
+    }
+}
+
+// Sorts items by text_of(item), byte-wise or case-folded, with equal texts
+// ordered by tie_of(item). Only the 16-byte keys move while sorting; the items
+// themselves are moved once into their final place.
+template <class T, class TextOf, class TieOf>
+void sort_by_text(vector<T> &items, TextOf text_of, bool fold, TieOf tie_of) {
+    vector<TextSortKey> keys(items.size());
+    for (size_t i = 0; i < items.size(); i++) keys[i].index = i;
+
+    auto text = [&](size_t i) -> decltype(auto) { return text_of(items[i]); };
+    auto tie = [&](size_t i) { return tie_of(items[i]); };
+    text_radix_sort(keys.data(), keys.size(), 0, fold, text, tie);
+
+    vector<T> sorted;
+    sorted.reserve(items.size());
+    for (const TextSortKey &k : keys) sorted.push_back(move(items[k.index]));
+    items.swap(sorted);
+}
+
+template <class T, class TextOf>
+void sort_by_text(vector<T> &items, TextOf text_of, bool fold) {
+    sort_by_text(items, text_of, fold, [](const T &) { return 0; });
+}
+
+#endif
@@ -1,70 +1,70 @@
 #include <bits/stdc++.h>
 #include <mpi.h>
+#include "search_modes.h"
+#include "parallel_output.h"
+#include "suffix_automaton.h"
+#include "node_shm.h"
+#include "large_count.h"
+#include "perf_counters.h"
 
 using namespace std;
 
 struct Entry {
-    int line_number;
+    long long line_number;
     string text;
 };
 
-string to_lower(const string &s) {
-    string res = s;
+string to_lower(string_view s) {
+    string res(s);
     transform(res.begin(), res.end(), res.begin(), ::tolower);
     return res;
 }
 
-// Compute longest common substring between two strings (case-insensitive)
-// Returns the substring itself
-string longest_common_substring(const string &a, const string &b) {
-    string sa = to_lower(a);
-    string sb = to_lower(b);
-    int n = sa.size(), m = sb.size();
-    vector<vector<int>> dp(n+1, vector<int>(m+1, 0));
-    int best = 0;
-    int end_pos = -1;
-    for (int i = 1; i <= n; i++) {
-        for (int j = 1; j <= m; j++) {
-            if (sa[i-1] == sb[j-1]) {
-                dp[i][j] = dp[i-1][j-1] + 1;
-                if (dp[i][j] > best) {
-                    best = dp[i][j];
-                    end_pos = i-1;
-                }
-            }
-        }
-    }
-    if (best > 0) {
-        return sa.substr(end_pos - best + 1, best);
-    }
-    return "";
-}
-
 void send_string(const string &text, int receiver) {
-    int len = text.size() + 1;
-    MPI_Send(&len, 1, MPI_INT, receiver, 1, MPI_COMM_WORLD);
-    MPI_Send(text.c_str(), len, MPI_CHAR, receiver, 1, MPI_COMM_WORLD);
+    long long len = text.size();
+    MPI_Send(&len, 1, MPI_LONG_LONG, receiver, 1, MPI_COMM_WORLD);
+    send_bytes(text.data(), len, receiver, 1, MPI_COMM_WORLD);
 }
 
 string receive_string(int sender) {
-    int len;
-    MPI_Status status;
-    MPI_Recv(&len, 1, MPI_INT, sender, 1, MPI_COMM_WORLD, &status);
-    char *buf = new char[len];
-    MPI_Recv(buf, len, MPI_CHAR, sender, 1, MPI_COMM_WORLD, &status);
-    string res(buf);
-    delete[] buf;
+    long long len;
+    MPI_Recv(&len, 1, MPI_LONG_LONG, sender, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    string res(len, '\0');
+    recv_bytes(&res[0], len, sender, 1, MPI_COMM_WORLD);
     return res;
 }
 
-string entries_to_string(const vector<Entry> &entries, int start, int end) {
+string entries_to_string(const vector<Entry> &entries, long long start, long long end) {
     string result;
-    for (int i = start; i < min((int)entries.size(), end); i++) {
+    for (long long i = start; i < min((long long)entries.size(), end); i++) {
         result += to_string(entries[i].line_number) + "|" + entries[i].text + "\n";
     }
     return result;
 }
 
+// A line searched in place, in this rank's entries or in the node's shared
+// window (--shm)
+struct EntryView {
+    long long line_number;
+    string_view text;
+};
+
+vector<EntryView> string_to_entry_views(string_view text) {
+    vector<EntryView> entries;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == string_view::npos) end = text.size();
+        string_view line = text.substr(start, end - start);
+        size_t pos = line.find('|');
+        if (pos != string_view::npos) {
+            entries.push_back({atoll(line.data()), line.substr(pos + 1)});
+        }
+        start = end + 1;
+    }
+    return entries;
+}
+
 vector<Entry> string_to_entries(const string &text) {
     vector<Entry> entries;
     istringstream iss(text);
@@ -73,7 +73,7 @@ vector<Entry> string_to_entries(const string &text) {
         if (!line.empty()) {
             size_t pos = line.find('|');
             if (pos != string::npos) {
-                int line_number = stoi(line.substr(0, pos));
+                long long line_number = stoll(line.substr(0, pos));
                 string content = line.substr(pos + 1);
                 entries.push_back({line_number, content});
             }
@@ -83,7 +83,7 @@ vector<Entry> string_to_entries(const string &text) {
 }
 
 void read_phonebook(const vector<string> &files, vector<Entry> &entries) {
-    int line_number = 1;
+    long long line_number = 1;
     for (const string &file : files) {
         ifstream f(file);
         if (!f.is_open()) {
@@ -100,15 +100,59 @@ void read_phonebook(const vector<string> &files, vector<Entry> &entries) {
     }
 }
 
+// Best substring of a rank, as a fixed-size record for the MPI reduction:
+// the header below followed by the lower-cased substring (at most as long as
+// the search term) and its terminating NUL
+struct BestHeader {
+    int len;
+    long long line_number;  // line where the substring first occurs
+};
+
+// Record size for a search term of term_len bytes
+int best_record_size(int term_len) {
+    return sizeof(BestHeader) + term_len + 1;
+}
+
+void pack_best(char *record, int len, long long line_number, const string &sub) {
+    BestHeader h = {len, line_number};
+    memcpy(record, &h, sizeof(h));
+    memcpy(record + sizeof(h), sub.c_str(), sub.size() + 1);
+}
+
+// MPI_Op: the longer substring wins, and between equally long ones the one
+// that occurs first in the input. That is the order of the serial scan, and
+// makes the result independent of the reduction order.
+void best_substring_op(void *in, void *inout, int *count, MPI_Datatype *type) {
+    int record_size;
+    MPI_Type_size(*type, &record_size);
+    char *a = (char *)in, *b = (char *)inout;
+    for (int i = 0; i < *count; i++, a += record_size, b += record_size) {
+        BestHeader ha, hb;
+        memcpy(&ha, a, sizeof(ha));
+        memcpy(&hb, b, sizeof(hb));
+        if (ha.len > hb.len || (ha.len == hb.len && ha.line_number < hb.line_number)) {
+            memcpy(b, a, record_size);
+        }
+    }
+}
+
 int main(int argc, char **argv) {
     MPI_Init(&argc, &argv);
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    if (argc < 3) {
+    SearchOptions opts;
+    int first_arg = parse_search_options(argc, argv, opts, rank);
+    if (first_arg > 0 && (opts.mode != RESULT_ALL || opts.phone_prefix || opts.regex || opts.max_errors >= 0 ||
+                          (opts.sample_sort && !opts.mpi_io))) {
+        if (rank == 0) cerr << "sub_str only supports --mpi-io, --shm and --perf\n";
+        first_arg = -1;
+    }
+
+    if (first_arg < 0 || argc - first_arg < 2) {
         if (rank == 0)
-            cerr << "Usage: mpirun -n <procs> " << argv[0] << " <file1>... <search_term>\n";
+            cerr << "Usage: mpirun -n <procs> " << argv[0] << " [--mpi-io] [--shm] [--perf] <file1>... <search_term>\n";
         MPI_Finalize();
         return 1;
     }
@@ -122,55 +166,141 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    double start_time, end_time;
+    double start_time = 0, end_time;
+
+    NodeInfo node;
+    MPI_Win shard_win = MPI_WIN_NULL;
+    if (opts.shm && !node_info_init(&node)) {
+        if (rank == 0) cerr << "--shm needs the ranks of each node numbered contiguously; using per-rank chunks\n";
+        opts.shm = false;
+    }
+
+    vector<Entry> all_entries, local_entries;
+    vector<EntryView> local_view;  // the lines this rank searches
 
     if (rank == 0) {
-        vector<string> files;
-        for (int i = 1; i < argc - 1; i++) files.push_back(argv[i]);
+        vector<string> files(argv + first_arg, argv + argc - 1);
 
-        vector<Entry> all_entries;
         read_phonebook(files, all_entries);
 
-        int total = all_entries.size();
-        int chunk = (total + size - 1) / size;
+        long long total = all_entries.size();
+        long long chunk = (total + size - 1) / size;
 
-        for (int i = 1; i < size; i++) {
+        for (int i = 1; i < size && !opts.shm; i++) {
             string text_chunk = entries_to_string(all_entries, i * chunk, (i + 1) * chunk);
             send_string(text_chunk, i);
         }
 
-        start_time = MPI_Wtime();
+        // The master keeps the first chunk for itself
+        if (!opts.shm) {
+            all_entries.resize(min(chunk, total));
+            local_entries.swap(all_entries);
+        }
+    } else if (!opts.shm) {
+        string recv_text = receive_string(0);
+        local_entries = string_to_entries(recv_text);
+    }
+
+    if (opts.shm) {
+        // Each node receives its part once and searches it in shared memory
+        string_view node_text = node_shard_text(node, all_entries.size(), [&](long long first, long long last) {
+            return entries_to_string(all_entries, first, last);
+        }, &shard_win);
+        vector<Entry>().swap(all_entries);
+        local_view = string_to_entry_views(node_text);
+    } else {
+        for (const Entry &e : local_entries) local_view.push_back({e.line_number, e.text});
+    }
 
-        string global_best_substring = "";
-        int global_best_len = 0;
+    if (rank == 0) start_time = MPI_Wtime();
 
-        // Master chunk
-        for (int i = 0; i < min(chunk, total); i++) {
-            string sub = longest_common_substring(all_entries[i].text, search_term);
-            if ((int)sub.size() > global_best_len) {
-                global_best_len = sub.size();
-                global_best_substring = sub;
-            }
+    // The term is compiled once; each line is then a single linear scan
+    SuffixAutomaton term_automaton = build_suffix_automaton(to_lower(search_term));
+
+    PerfCounters perf = {{0}, 0};
+    long long counts[PERF_EVENTS];
+    if (opts.perf) perf_start(&perf);
+    double local_start = MPI_Wtime();
+    string local_best_substring = "";
+    int local_best_len = 0;
+    long long local_best_line = LLONG_MAX;
+    for (const EntryView &entry : local_view) {
+        int end;
+        int len = longest_common_substring(term_automaton, entry.text, end);
+        if (len > local_best_len) {
+            local_best_len = len;
+            local_best_substring = to_lower(entry.text.substr(end - len + 1, len));
+            local_best_line = entry.line_number;
         }
+    }
+    double local_end = MPI_Wtime();
+    if (opts.perf) perf_stop(&perf, counts);
+    printf("Process %d processed %lu lines in %f seconds.\n",
+           rank, local_view.size(), local_end - local_start);
+    if (opts.perf) report_perf("substring scan", &perf, counts, local_view.size(), "line", MPI_COMM_WORLD);
 
-        // Gather from workers
-        for (int i = 1; i < size; i++) {
-            string worker_best = receive_string(i);
-            if ((int)worker_best.size() > global_best_len) {
-                global_best_len = worker_best.size();
-                global_best_substring = worker_best;
+    // Every rank agrees on the global best substring with one reduction
+    int record_size = best_record_size(search_term.size());
+    MPI_Datatype best_type;
+    MPI_Type_contiguous(record_size, MPI_BYTE, &best_type);
+    MPI_Type_commit(&best_type);
+    MPI_Op best_op;
+    MPI_Op_create(best_substring_op, 1, &best_op);
+
+    vector<char> local_best(record_size), global_best(record_size);
+    pack_best(local_best.data(), local_best_len, local_best_line, local_best_substring);
+    MPI_Allreduce(local_best.data(), global_best.data(), 1, best_type, best_op, MPI_COMM_WORLD);
+    MPI_Op_free(&best_op);
+    MPI_Type_free(&best_type);
+
+    string global_best_substring(global_best.data() + sizeof(BestHeader));
+
+    // Now every rank filters its own chunk by global_best_substring
+    vector<Entry> local_matches;
+    if (!global_best_substring.empty()) {
+        for (const EntryView &e : local_view) {
+            string lower_line = to_lower(e.text);
+            if (lower_line.find(global_best_substring) != string::npos) {
+                local_matches.push_back({e.line_number, string(e.text)});
             }
         }
+    }
 
-        // Now filter all entries by global_best_substring
-        vector<Entry> final_matches;
-        if (global_best_len > 0) {
-            for (const Entry &e : all_entries) {
-                string lower_line = to_lower(e.text);
-                if (lower_line.find(global_best_substring) != string::npos) {
-                    final_matches.push_back(e);
-                }
+    int status = 0;  // 1 if output.txt could not be written
+    if (opts.mpi_io) {
+        // Every rank writes its matches to output.txt; rank 0 adds the header
+        string out_text;
+        if (rank == 0) {
+            out_text = global_best_substring.empty()
+                           ? "No match found.\n"
+                           : "Longest match substring: " + global_best_substring + "\n";
+        }
+        for (const Entry &match : local_matches) {
+            out_text += to_string(match.line_number) + ": " + match.text + "\n";
+        }
+        if (!write_ordered("output.txt", out_text, MPI_COMM_WORLD)) status = 1;
+
+        long long local_found = local_matches.size(), total_found = 0;
+        MPI_Reduce(&local_found, &total_found, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (rank == 0 && !status) {
+            end_time = MPI_Wtime();
+            if (total_found > 0) {
+                cout << "Found " << total_found
+                     << " contacts containing longest substring \"" << global_best_substring << "\"." << endl;
+            } else {
+                cout << "No match found.\n";
             }
+            printf("Total execution time: %f seconds.\n", end_time - start_time);
+        }
+    } else if (rank != 0) {
+        send_string(entries_to_string(local_matches, 0, local_matches.size()), 0);
+    } else {
+        // Chunks are in line order, so the matches arrive in line order too
+        vector<Entry> final_matches;
+        final_matches.swap(local_matches);
+        for (int i = 1; i < size; i++) {
+            vector<Entry> worker_vec = string_to_entries(receive_string(i));
+            final_matches.insert(final_matches.end(), worker_vec.begin(), worker_vec.end());
         }
 
         end_time = MPI_Wtime();
@@ -190,28 +320,22 @@ int main(int argc, char **argv) {
         out.close();
 
         printf("Total execution time: %f seconds.\n", end_time - start_time);
+    }
 
-    } else {
-        string recv_text = receive_string(0);
-        vector<Entry> local_entries = string_to_entries(recv_text);
-        
-        double worker_start = MPI_Wtime();
-        string local_best_substring = "";
-        int local_best_len = 0;
-        for (const Entry &entry : local_entries) {
-            string sub = longest_common_substring(entry.text, search_term);
-            if ((int)sub.size() > local_best_len) {
-                local_best_len = sub.size();
-                local_best_substring = sub;
-            }
-        }
-        double worker_end = MPI_Wtime();
-
-        send_string(local_best_substring, 0);
-        printf("Process %d processed %lu lines in %f seconds.\n",
-               rank, local_entries.size(), worker_end - worker_start);
+    if (opts.shm) {
+        node_shared_free(&shard_win);
+        node_info_free(&node);
     }
 
     MPI_Finalize();
-    return 0;
+    return status;
 }
+
+
+/*
+mpic++ sub_str.cpp -o sub_str
+mpirun -n 4 ./sub_str input.txt 'ul mah'
+mpirun -n 4 ./sub_str --mpi-io input.txt 'ul mah'
+mpirun -n 4 ./sub_str --shm input.txt 'ul mah'
+mpirun -n 4 ./sub_str --perf input.txt 'ul mah'
+*/
@@ -0,0 +1,100 @@
+#ifndef SUFFIX_AUTOMATON_H
+#define SUFFIX_AUTOMATON_H
+
+#include <bits/stdc++.h>
+
+using namespace std;
+
+// Suffix automaton of the search term, in flat arrays. Transitions are
+// indexed by byte class: only bytes that occur in the term get a column,
+// every other byte has class -1 and can never extend a match.
+struct SuffixAutomaton {
+    int alphabet = 0;
+    int byte_class[256];
+    vector<int> len, link;
+    vector<int> next;  // next[state * alphabet + class], -1 when missing
+};
+
+// Builds the automaton of term (already lower-cased), which has at most
+// 2 * term.size() states
+inline SuffixAutomaton build_suffix_automaton(const string &term) {
+    SuffixAutomaton sam;
+    fill(sam.byte_class, sam.byte_class + 256, -1);
+    for (unsigned char c : term) {
+        if (sam.byte_class[c] < 0) sam.byte_class[c] = sam.alphabet++;
+    }
+
+    int a = sam.alphabet;
+    size_t max_states = 2 * term.size() + 1;
+    sam.len.reserve(max_states);
+    sam.link.reserve(max_states);
+    sam.next.reserve(max_states * a);
+
+    auto add_state = [&](int len, int link) {
+        sam.len.push_back(len);
+        sam.link.push_back(link);
+        sam.next.insert(sam.next.end(), a, -1);
+        return (int)sam.len.size() - 1;
+    };
+
+    int last = add_state(0, -1);
+    for (unsigned char ch : term) {
+        int c = sam.byte_class[ch];
+        int cur = add_state(sam.len[last] + 1, 0);
+        int p = last;
+        while (p != -1 && sam.next[p * a + c] < 0) {
+            sam.next[p * a + c] = cur;
+            p = sam.link[p];
+        }
+        if (p != -1) {
+            int q = sam.next[p * a + c];
+            if (sam.len[p] + 1 == sam.len[q]) {
+                sam.link[cur] = q;
+            } else {
+                int clone = add_state(sam.len[p] + 1, sam.link[q]);
+                copy(sam.next.begin() + q * a, sam.next.begin() + (q + 1) * a,
+                     sam.next.begin() + clone * a);
+                while (p != -1 && sam.next[p * a + c] == q) {
+                    sam.next[p * a + c] = clone;
+                    p = sam.link[p];
+                }
+                sam.link[q] = clone;
+                sam.link[cur] = clone;
+            }
+        }
+        last = cur;
+    }
+    return sam;
+}
+
+// Length of the longest substring of text (compared case-insensitively) that
+// also occurs in the term, in O(text.size()). end is set to the index in text
+// of its last byte; among equally long substrings the first one wins.
+inline int longest_common_substring(const SuffixAutomaton &sam, string_view text, int &end) {
+    int a = sam.alphabet;
+    int state = 0, len = 0, best = 0;
+    end = -1;
+    for (int i = 0; i < (int)text.size(); i++) {
+        int c = sam.byte_class[(unsigned char)tolower((unsigned char)text[i])];
+        if (c < 0) {
+            state = 0;
+            len = 0;
+            continue;
+        }
+        while (state != 0 && sam.next[state * a + c] < 0) {
+            state = sam.link[state];
+            len = sam.len[state];
+        }
+        if (sam.next[state * a + c] >= 0) {
+            state = sam.next[state * a + c];
+            len++;
+        }
+        if (len > best) {
+            best = len;
+            end = i;
+        }
+    }
+    return best;
+}
+
+#endif